@@ -0,0 +1,86 @@
+#include <ns_getopt/ns_getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Command string cost. Splits, then parses, millions of short commands like
+ * a job queue would deliver them, quoted or not. Commands are split in
+ * place, so each is first copied to a scratch buffer, copy included in
+ * the timings.
+ **/
+
+constexpr size_t commands_size = 2'000'000;
+
+std::vector<std::string> make_commands() {
+	const char* forms[] = {
+		"tool -v --output out.txt in.txt",
+		"tool --level 3 'my input.txt'",
+		"tool -o \"out dir/result.txt\" a b c",
+		"tool --output plain in\\ put.txt",
+		"tool -v -o 'x' \"y\" z",
+	};
+	std::vector<std::string> ret;
+	ret.reserve(commands_size);
+	for (size_t i = 0; i < commands_size; ++i) {
+		std::string c = forms[i % (sizeof(forms) / sizeof(*forms))];
+		c += " job" + std::to_string(i);
+		ret.push_back(std::move(c));
+	}
+	return ret;
+}
+
+int main(int, char**) {
+	const std::vector<std::string> commands = make_commands();
+	size_t bytes = 0;
+	for (const std::string& c : commands) {
+		bytes += c.size();
+	}
+
+	auto yes = []() { return true; };
+	auto any = [](std::string_view) { return true; };
+	std::array<opt::argument, 4> args = { {
+			{ "verbose", opt::type::no_arg, yes, "", 'v' },
+			{ "output", opt::type::optional_arg, any, "", 'o' },
+			{ "level", opt::type::required_arg, any, "", 'l' },
+			{ "files", opt::type::variadic_arg,
+					[](opt::argv_span) { return true; } },
+	} };
+	opt::compiled_table<4> table(args);
+	opt::options o = { "", "",
+		opt::no_user_error_messages | opt::dont_print_help
+				| opt::arguments_are_optional };
+
+	char scratch[256];
+	size_t tokens = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (const std::string& c : commands) {
+		memcpy(scratch, c.c_str(), c.size() + 1);
+		opt::command_argv split(scratch);
+		tokens += (size_t)split.argc;
+	}
+	std::chrono::duration<double, std::nano> d
+			= std::chrono::steady_clock::now() - start;
+	printf("split        : %6.1f ns per command, %5.2f ns per byte, "
+		   "%zu tokens\n",
+			d.count() / commands_size, d.count() / bytes, tokens);
+
+	size_t failed = 0;
+	start = std::chrono::steady_clock::now();
+	for (const std::string& c : commands) {
+		memcpy(scratch, c.c_str(), c.size() + 1);
+		for (opt::argument& a : args) {
+			a.parsed = false;
+		}
+		if (!opt::parse_command<4>(scratch, args.data(), table, o))
+			++failed;
+	}
+	d = std::chrono::steady_clock::now() - start;
+	printf("split, parse : %6.1f ns per command, %zu failed\n",
+			d.count() / commands_size, failed);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <ns_getopt/ns_getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Option lookup cost. Parses a command line of 8 options, picked across the
+ * table, against tables of growing size. Either builds the lookup index on
+ * every parse (the default), or reuses a prebuilt opt::compiled_table.
+ * Lookups alone are timed separately, on the prebuilt index.
+ **/
+
+volatile size_t lookup_sink = 0; // Keeps the lookups.
+
+template <size_t args_size>
+void bench() {
+	std::vector<std::string> names;
+	names.reserve(args_size);
+	for (size_t i = 0; i < args_size; ++i) {
+		names.push_back("option_" + std::to_string(i));
+	}
+
+	std::vector<opt::argument> args;
+	args.reserve(args_size);
+	for (size_t i = 0; i < args_size; ++i) {
+		args.push_back({ names[i], opt::type::no_arg, []() { return true; } });
+	}
+
+	std::vector<size_t> picked;
+	std::vector<std::string> tokens;
+	for (size_t i = 0; i < 8; ++i) {
+		picked.push_back((args_size - 1) * (i + 1) / 8);
+		tokens.push_back("--" + names[picked.back()]);
+	}
+	std::vector<const char*> argv = { "./exec" };
+	for (const std::string& t : tokens) {
+		argv.push_back(t.c_str());
+	}
+
+	opt::compiled_table<args_size> table(args.data());
+	const size_t iterations = 2'000'000 / args_size + 100;
+
+	/* Only the picked options are parsed, resetting the others would
+	 * grow with the table. */
+	auto time_parses = [&](bool prebuilt) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t it = 0; it < iterations; ++it) {
+			for (size_t i : picked) {
+				args[i].parsed = false;
+			}
+			const bool succeeded = prebuilt
+					? opt::parse_arguments<args_size>(
+							(int)argv.size(), argv.data(), args.data(), table)
+					: opt::parse_arguments<args_size>(
+							(int)argv.size(), argv.data(), args.data());
+			if (!succeeded) {
+				printf("Parsing failed.\n");
+				return 0.0;
+			}
+		}
+		std::chrono::duration<double, std::nano> d
+				= std::chrono::steady_clock::now() - start;
+		return d.count() / iterations;
+	};
+
+	const double rebuilt = time_parses(false);
+	const double prebuilt = time_parses(true);
+
+	const opt::detail::lookup_table index = table.table();
+	const size_t lookups = 20'000'000;
+	size_t checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t it = 0; it < lookups / 8; ++it) {
+		for (const std::string& t : tokens) {
+			checksum += index.find_long(
+					std::string_view(t).substr(2), args.data());
+		}
+	}
+	std::chrono::duration<double, std::nano> d
+			= std::chrono::steady_clock::now() - start;
+	lookup_sink = checksum;
+
+	printf("%6zu options : %9.1f ns per parse, %8.1f prebuilt, "
+		   "%5.1f ns per lookup\n",
+			args_size, rebuilt, prebuilt, d.count() / lookups);
+}
+
+int main(int, char**) {
+	printf("sizeof(opt::argument) : %zu bytes\n", sizeof(opt::argument));
+	printf("sizeof(opt::compiled_table<4096>) : %zu bytes\n",
+			sizeof(opt::compiled_table<4096>));
+	bench<8>();
+	bench<64>();
+	bench<512>();
+	bench<4096>();
+	return 0;
+}
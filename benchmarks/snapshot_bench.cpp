@@ -0,0 +1,130 @@
+#include <ns_getopt/ns_getopt.h>
+#include <ns_getopt/snapshot.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Read contention. Reader threads look up an option value in a loop while
+ * a writer reparses and republishes every 100 us. Compares the published
+ * snapshot against a parse_result behind a std::shared_mutex, the usual
+ * way to guard reconfigurable options. Reported per read, averaged over
+ * every reader.
+ **/
+
+constexpr auto run_time = std::chrono::milliseconds(500);
+constexpr auto publish_every = std::chrono::microseconds(100);
+
+/* Owns argv, the parse points into it. */
+struct config {
+	explicit config(int generation)
+			: level(std::to_string(generation)) {
+		argv = { "./exec", "--verbose", "--output", "out.txt", "--level",
+			level.c_str() };
+		opt::parse_results((int)argv.size(), argv.data(), args, result, o);
+	}
+
+	std::string level;
+	std::vector<const char*> argv;
+	std::array<opt::argument, 3> args = { {
+			{ "verbose", opt::type::no_arg, "", 'v' },
+			{ "output", opt::type::required_arg, "", 'o' },
+			{ "level", opt::type::required_arg, "", 'l' },
+	} };
+	std::array<opt::parsed_arg, 3> parsed;
+	opt::parse_result result{ parsed.data(), parsed.size() };
+	opt::options o = { "", "",
+		opt::no_user_error_messages | opt::dont_print_help };
+};
+
+/* Calls read on readers threads until run_time is up, write meanwhile. */
+template <class Read, class Write>
+void run(const char* name, size_t readers, Read read, Write write) {
+	std::atomic<bool> done{ false };
+	std::atomic<size_t> started{ 0 };
+	std::atomic<size_t> reads{ 0 };
+	std::atomic<size_t> checksum{ 0 }; // Keeps the reads.
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < readers; ++i) {
+		threads.emplace_back([&]() {
+			size_t n = 0;
+			size_t sum = 0;
+			++started;
+			while (!done.load(std::memory_order_relaxed)) {
+				sum += read();
+				++n;
+			}
+			reads += n;
+			checksum += sum;
+		});
+	}
+	while (started != readers) {
+		std::this_thread::yield();
+	}
+
+	size_t publishes = 0;
+	int generation = 0;
+	const auto start = std::chrono::steady_clock::now();
+	auto next = start;
+	while (std::chrono::steady_clock::now() - start < run_time) {
+		next += publish_every;
+		write(++generation);
+		++publishes;
+		std::this_thread::sleep_until(next);
+	}
+	done = true;
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	std::chrono::duration<double, std::nano> d
+			= std::chrono::steady_clock::now() - start;
+	printf("%-8s %3zu readers : %7.1f ns per read, %6.1f M reads/s, "
+		   "%zu publishes\n",
+			name, readers, d.count() * readers / reads,
+			reads / d.count() * 1e3, publishes);
+}
+
+int main(int argc, char** argv) {
+	const size_t max_readers = argc > 1
+			? (size_t)atoi(argv[1])
+			: std::max(2u, std::thread::hardware_concurrency() * 2);
+
+	for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+		std::shared_mutex mutex;
+		auto locked = std::make_unique<config>(0);
+		run("mutex", readers,
+				[&]() {
+					std::shared_lock<std::shared_mutex> lock(mutex);
+					return locked->result.get(2).size();
+				},
+				[&](int generation) {
+					auto next = std::make_unique<config>(generation);
+					std::unique_lock<std::shared_mutex> lock(mutex);
+					locked = std::move(next);
+				});
+
+		opt::snapshot_publisher pub(max_readers);
+		pub.publish(config(0).result);
+		run("snapshot", readers,
+				[&]() {
+					/* One slot per thread, joined on first read. */
+					thread_local opt::snapshot_publisher::slot* s = pub.join();
+					return pub.read(s)->get(2).size();
+				},
+				[&](int generation) {
+					pub.publish(config(generation).result);
+				});
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <ns_getopt/ns_getopt.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/**
+ * libFuzzer target. The input is split on '\0' into argv tokens. The first
+ * byte selects the parsing flags, so error paths, optional arguments and
+ * arg0 handling all get exercised.
+ **/
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+	/* print_help output is irrelevant, and slow. */
+	FILE* f = freopen("/dev/null", "w", stdout);
+	(void)f;
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (size == 0)
+		return 0;
+
+	opt::flag flags = opt::no_user_error_messages | opt::dont_print_help;
+	if (data[0] & 1)
+		flags |= opt::arguments_are_optional;
+	if (data[0] & 2)
+		flags |= opt::arg0_is_normal_argument;
+	const bool do_print_help = (data[0] & 4) != 0;
+
+	std::vector<char> buf(data + 1, data + size);
+	buf.push_back('\0');
+
+	std::vector<const char*> argv;
+	argv.push_back(buf.data());
+	for (size_t i = 0; i + 1 < buf.size(); ++i) {
+		if (buf[i] == '\0')
+			argv.push_back(&buf[i + 1]);
+	}
+
+	auto one_arg = [](std::string_view) { return true; };
+	auto multi_arg = [](const opt::multi_array& a, size_t len) {
+		return len <= a.size();
+	};
+
+	std::array<opt::argument, 9> args = { {
+			{ "test", opt::type::no_arg, []() { return true; }, "", 't' },
+			{ "M", opt::type::no_arg, []() { return true; }, "", 'M' },
+			{ "fail", opt::type::no_arg, []() { return false; }, "", 'f' },
+			{ "required", opt::type::required_arg, one_arg, "", 'r' },
+			{ "optional", opt::type::optional_arg, one_arg, "", 'o' },
+			{ "default", opt::type::default_arg, one_arg, "", 'd', "def" },
+			{ "multi", opt::type::multi_arg, multi_arg, "", 'm', 3 },
+			{ "multi_max", opt::type::multi_arg, multi_arg, "", 'x' },
+			{ "in_file", opt::type::raw_arg, one_arg, "" },
+	} };
+
+	opt::options o = { "intro", "outro", flags };
+	opt::parse_arguments((int)argv.size(), argv.data(), args, o);
+
+	if (do_print_help) {
+		opt::print_help(args, argv[0], o);
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Runs the fuzz target once over every file given on the command line. Used
+ * to replay the corpus as a regression test on compilers without libFuzzer.
+ **/
+
+extern "C" int LLVMFuzzerInitialize(int*, char***);
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char** argv) {
+	LLVMFuzzerInitialize(&argc, &argv);
+
+	for (int i = 1; i < argc; ++i) {
+		FILE* f = fopen(argv[i], "rb");
+		if (f == nullptr) {
+			fprintf(stderr, "Couldn't open '%s'.\n", argv[i]);
+			return -1;
+		}
+
+		std::vector<uint8_t> data;
+		uint8_t buf[4096];
+		size_t read;
+		while ((read = fread(buf, 1, sizeof(buf), f)) > 0) {
+			data.insert(data.end(), buf, buf + read);
+		}
+		fclose(f);
+
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+	}
+	return 0;
+}
@@ -0,0 +1,499 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2017, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include <ns_getopt/ns_getopt.h>
+
+/* Asynchronous callbacks require C++20 coroutines. */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace opt {
+/**
+ * Coroutine returned by asynchronous callbacks. Lazily started, resolves to
+ * whether the callback succeeded. Exceptions are rethrown to the awaiter.
+ **/
+struct task {
+	struct promise_type;
+
+	inline task(task&& other) noexcept;
+	inline task& operator=(task&& other) noexcept;
+	inline ~task();
+
+	inline bool await_ready() const noexcept;
+	inline std::coroutine_handle<> await_suspend(
+			std::coroutine_handle<> awaiter) noexcept;
+	inline bool await_resume();
+
+private:
+	inline explicit task(std::coroutine_handle<promise_type> handle);
+	std::coroutine_handle<promise_type> _handle;
+};
+
+/* Blocks until t resolves. */
+inline bool sync_wait(task t);
+
+/**
+ * Wraps a callback returning an opt::task, so it can be stored in an
+ * argument. With parse_arguments_async, the task is started and awaited
+ * alongside the others. With parse_arguments, it is waited on in place.
+ **/
+template <class F>
+struct async_callback {
+	F func;
+
+	template <class... Args,
+			class = std::enable_if_t<std::is_same_v<
+					std::invoke_result_t<const F&, Args...>, task>>>
+	bool operator()(Args&&... args) const;
+};
+
+template <class F>
+async_callback<std::decay_t<F>> async(F&& func);
+
+/**
+ * Awaitable, runs a blocking function (file or socket I/O) on its own
+ * thread. The awaiting coroutine resumes on that thread.
+ **/
+template <class F>
+struct run_blocking {
+	using result_type = std::invoke_result_t<F&>;
+
+	explicit run_blocking(F func);
+
+	bool await_ready() const noexcept;
+	void await_suspend(std::coroutine_handle<> awaiter);
+	result_type await_resume();
+
+private:
+	F _func;
+	std::conditional_t<std::is_void_v<result_type>, bool, result_type>
+			_result{};
+	std::exception_ptr _exception;
+};
+
+/**
+ * Parses like flag::deferred_callbacks, then starts every callback of a
+ * phase and resolves once they all completed or one failed. Failures are
+ * reported like parse_arguments does. argv and args must outlive the
+ * returned task. option is copied in, the task starts when awaited.
+ **/
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, options option = {});
+
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		argument (&args)[args_size], options option = {});
+
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		argument* args, options option = {});
+
+namespace detail {
+
+/* Fire and forget coroutine, destroys itself when done. */
+struct detached_task {
+	struct promise_type {
+		detached_task get_return_object() noexcept {
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() noexcept {
+		}
+		void unhandled_exception() noexcept {
+			std::terminate();
+		}
+	};
+};
+
+/* Tracks the tasks spawned while dispatching one phase. */
+struct async_scope {
+	inline void spawn(task t);
+	inline void complete(size_t event_index, bool succeeded,
+			std::exception_ptr exception);
+	inline void fail(size_t event_index);
+
+	/* Awaitable, resumes once every spawned task completed. */
+	struct join_awaiter {
+		async_scope& scope;
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+		inline bool await_suspend(std::coroutine_handle<> awaiter) noexcept;
+		void await_resume() const noexcept {
+		}
+	};
+	inline join_awaiter join();
+
+	/* Event being dispatched on this thread. */
+	size_t current_event = 0;
+
+	std::mutex mutex;
+	size_t failed = size_t(-1); // First failed event, in argv order.
+	std::exception_ptr exception;
+
+	/* The dispatcher holds one reference until it joins. */
+	std::atomic<size_t> pending{ 1 };
+	std::coroutine_handle<> continuation;
+};
+
+/* Set while a callback is invoked by parse_arguments_async. */
+inline thread_local async_scope* current_async_scope = nullptr;
+
+inline bool start_task(task t);
+
+inline detached_task run_in_scope(async_scope& scope, task t, size_t idx);
+
+inline task dispatch_events_async(const argument* args, size_t args_size,
+		parse_event* events, size_t events_size, char const* const* argv,
+		const options& option);
+
+} // namespace detail
+
+
+/* Implementation. */
+struct task::promise_type {
+	bool result = false;
+	std::exception_ptr exception;
+	std::coroutine_handle<> continuation;
+
+	task get_return_object() noexcept {
+		return task{ std::coroutine_handle<promise_type>::from_promise(
+				*this) };
+	}
+
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+
+	/* Symmetric transfer back to whoever awaited us. */
+	struct final_awaiter {
+		bool await_ready() const noexcept {
+			return false;
+		}
+		std::coroutine_handle<> await_suspend(
+				std::coroutine_handle<promise_type> h) noexcept {
+			if (h.promise().continuation)
+				return h.promise().continuation;
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept {
+		}
+	};
+
+	final_awaiter final_suspend() noexcept {
+		return {};
+	}
+
+	void return_value(bool succeeded) noexcept {
+		result = succeeded;
+	}
+
+	void unhandled_exception() noexcept {
+		exception = std::current_exception();
+	}
+};
+
+inline task::task(std::coroutine_handle<promise_type> handle)
+		: _handle(handle) {
+}
+
+inline task::task(task&& other) noexcept
+		: _handle(std::exchange(other._handle, nullptr)) {
+}
+
+inline task& task::operator=(task&& other) noexcept {
+	if (this != &other) {
+		if (_handle)
+			_handle.destroy();
+		_handle = std::exchange(other._handle, nullptr);
+	}
+	return *this;
+}
+
+inline task::~task() {
+	if (_handle)
+		_handle.destroy();
+}
+
+inline bool task::await_ready() const noexcept {
+	return !_handle || _handle.done();
+}
+
+inline std::coroutine_handle<> task::await_suspend(
+		std::coroutine_handle<> awaiter) noexcept {
+	_handle.promise().continuation = awaiter;
+	return _handle;
+}
+
+inline bool task::await_resume() {
+	if (!_handle)
+		return false;
+	if (_handle.promise().exception)
+		std::rethrow_exception(_handle.promise().exception);
+	return _handle.promise().result;
+}
+
+inline bool sync_wait(task t) {
+	struct state {
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool done = false;
+		bool result = false;
+		std::exception_ptr exception;
+	} s;
+
+	auto waiter = [](task t, state& s) -> detail::detached_task {
+		bool result = false;
+		std::exception_ptr exception;
+		try {
+			result = co_await t;
+		} catch (...) {
+			exception = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.result = result;
+		s.exception = exception;
+		s.done = true;
+		s.cv.notify_all();
+	};
+	waiter(std::move(t), s);
+
+	std::unique_lock<std::mutex> lock(s.mutex);
+	s.cv.wait(lock, [&]() { return s.done; });
+	if (s.exception)
+		std::rethrow_exception(s.exception);
+	return s.result;
+}
+
+template <class F>
+template <class... Args, class>
+bool async_callback<F>::operator()(Args&&... args) const {
+	return detail::start_task(func(std::forward<Args>(args)...));
+}
+
+template <class F>
+async_callback<std::decay_t<F>> async(F&& func) {
+	return { std::forward<F>(func) };
+}
+
+template <class F>
+run_blocking<F>::run_blocking(F func)
+		: _func(std::move(func)) {
+}
+
+template <class F>
+bool run_blocking<F>::await_ready() const noexcept {
+	return false;
+}
+
+template <class F>
+void run_blocking<F>::await_suspend(std::coroutine_handle<> awaiter) {
+	std::thread([this, awaiter]() {
+		try {
+			if constexpr (std::is_void_v<result_type>) {
+				_func();
+			} else {
+				_result = _func();
+			}
+		} catch (...) {
+			_exception = std::current_exception();
+		}
+		awaiter.resume();
+	}).detach();
+}
+
+template <class F>
+typename run_blocking<F>::result_type run_blocking<F>::await_resume() {
+	if (_exception)
+		std::rethrow_exception(_exception);
+	if constexpr (!std::is_void_v<result_type>) {
+		return std::move(_result);
+	}
+}
+
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, options option) {
+	return parse_arguments_async<args_size>(argc, argv, args.data(), option);
+}
+
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		argument (&args)[args_size], options option) {
+	return parse_arguments_async<args_size>(
+			argc, argv, (argument*)args, option);
+}
+
+template <size_t args_size>
+inline task parse_arguments_async(int argc, char const* const* argv,
+		argument* args, options option) {
+	using namespace detail;
+
+	compiled_table<args_size> table(args);
+	std::array<parse_event, args_size> events;
+	event_list list{ events.data(), 0 };
+	std::pmr::vector<char const*> list_values(option.resource);
+	if (!parse_tokens(argc, argv, args, args_size, table.table(), option,
+				make_sink(list), list_values))
+		co_return false;
+
+	co_return co_await dispatch_events_async(
+			args, args_size, events.data(), list.size, argv, option);
+}
+
+namespace detail {
+
+inline void async_scope::spawn(task t) {
+	pending.fetch_add(1);
+	run_in_scope(*this, std::move(t), current_event);
+}
+
+inline void async_scope::complete(
+		size_t event_index, bool succeeded, std::exception_ptr e) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (e && !exception)
+			exception = e;
+		if (!succeeded && event_index < failed)
+			failed = event_index;
+	}
+
+	if (pending.fetch_sub(1) == 1)
+		continuation.resume();
+}
+
+inline void async_scope::fail(size_t event_index) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (event_index < failed)
+		failed = event_index;
+}
+
+inline bool async_scope::join_awaiter::await_suspend(
+		std::coroutine_handle<> awaiter) noexcept {
+	scope.continuation = awaiter;
+	/* Drop the dispatcher reference, suspend if tasks are still going. */
+	return scope.pending.fetch_sub(1) != 1;
+}
+
+inline async_scope::join_awaiter async_scope::join() {
+	return { *this };
+}
+
+inline bool start_task(task t) {
+	if (current_async_scope == nullptr)
+		return sync_wait(std::move(t));
+
+	current_async_scope->spawn(std::move(t));
+	return true;
+}
+
+inline detached_task run_in_scope(async_scope& scope, task t, size_t idx) {
+	bool succeeded = false;
+	std::exception_ptr exception;
+	try {
+		succeeded = co_await t;
+	} catch (...) {
+		exception = std::current_exception();
+	}
+	scope.complete(idx, succeeded, exception);
+}
+
+inline task dispatch_events_async(const argument* args, size_t args_size,
+		parse_event* events, size_t events_size, char const* const* argv,
+		const options& option) {
+	sort_by_phase(args, events, events_size, option.resource);
+
+	for (size_t phase_beg = 0; phase_beg < events_size;) {
+		const unsigned char phase = args[events[phase_beg].arg_index].phase;
+		size_t phase_end = phase_beg;
+		while (phase_end < events_size
+				&& args[events[phase_end].arg_index].phase == phase) {
+			++phase_end;
+		}
+
+		/* Synchronous callbacks run in place, asynchronous ones are
+		 * started and overlap. */
+		async_scope scope;
+		for (size_t j = phase_beg; j < phase_end; ++j) {
+			const parse_event& ev = events[j];
+			scope.current_event = j;
+			current_async_scope = &scope;
+			bool succeeded = false;
+			try {
+				succeeded = invoke_callback(args[ev.arg_index], ev);
+			} catch (...) {
+				/* Started tasks reference the scope, join them first. */
+				std::lock_guard<std::mutex> lock(scope.mutex);
+				scope.exception = std::current_exception();
+			}
+			current_async_scope = nullptr;
+
+			if (!succeeded) {
+				scope.fail(j);
+				break;
+			}
+		}
+		co_await scope.join();
+
+		if (scope.exception)
+			std::rethrow_exception(scope.exception);
+
+		if (scope.failed != size_t(-1)) {
+			const parse_event& ev = events[scope.failed];
+			maybe_print_msg(option, callback_error_msg(args[ev.arg_index], ev));
+			co_return do_exit(args, args_size, option, argv[0]);
+		}
+		phase_beg = phase_end;
+	}
+	co_return true;
+}
+
+} // namespace detail
+} // namespace opt
+#endif
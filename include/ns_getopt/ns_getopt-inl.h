@@ -0,0 +1,1981 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2017, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+/**
+ * Non-template implementation. Included by ns_getopt.h, unless
+ * NS_GETOPT_COMPILED is defined, in which case the ns_getopt::compiled
+ * library provides it instead.
+ **/
+
+#pragma once
+#include <ns_getopt/ns_getopt.h>
+
+#include <atomic>
+#include <cctype> // std::isalnum
+#include <charconv>
+#include <cstdio>
+#include <thread>
+
+#include <sys/stat.h>
+
+namespace opt {
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		const std::function<bool()>& no_arg_func, std::string_view description,
+		char short_arg)
+		: no_arg_func(no_arg_func)
+		, long_arg(long_arg)
+		, description(description)
+		, multi_max_len(0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert(arg_type == type::no_arg);
+	asserts();
+}
+
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		const std::function<bool(std::string_view)>& one_arg_func,
+		std::string_view description, char short_arg,
+		std::string_view default_arg)
+		: one_arg_func(one_arg_func)
+		, long_arg(long_arg)
+		, description(description)
+		, default_arg(default_arg)
+		, multi_max_len(0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert(arg_type == type::required_arg || arg_type == type::optional_arg
+			|| arg_type == type::default_arg || arg_type == type::raw_arg);
+	asserts();
+}
+
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		const std::function<bool(const multi_array&, size_t)>& multi_arg_func,
+		std::string_view description, char short_arg, size_t multi_max_subargs)
+		: multi_arg_func(multi_arg_func)
+		, long_arg(long_arg)
+		, description(description)
+		, multi_max_len(std::min(multi_max_subargs, multi_array_max_size))
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert(arg_type == type::multi_arg);
+	assert(multi_max_subargs <= multi_array_max_size
+			&& "multi_arg values are stored in a multi_array.");
+	asserts();
+}
+
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		const std::function<bool(argv_span)>& span_arg_func,
+		std::string_view description, char short_arg)
+		: span_arg_func(span_arg_func)
+		, long_arg(long_arg)
+		, description(description)
+		, multi_max_len(0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert(arg_type == type::variadic_arg || arg_type == type::list_arg);
+	assert((arg_type != type::variadic_arg || short_arg == '\0')
+			&& "Positional arguments have no short_arg.");
+	asserts();
+}
+
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		const std::function<bool(size_t)>& count_arg_func,
+		std::string_view description, char short_arg)
+		: count_arg_func(count_arg_func)
+		, long_arg(long_arg)
+		, description(description)
+		, multi_max_len(0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert(arg_type == type::count_arg);
+	asserts();
+}
+
+NS_GETOPT_INLINE argument::argument(std::string_view long_arg, type arg_type,
+		std::string_view description, char short_arg,
+		std::string_view default_arg)
+		: long_arg(long_arg)
+		, description(description)
+		, default_arg(default_arg)
+		, multi_max_len(arg_type == type::multi_arg ? multi_array_max_size : 0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	asserts();
+}
+
+NS_GETOPT_INLINE detail::lookup_table prebuilt_table::table() const {
+	/* Parsing only reads the arrays, present is never touched without
+	 * constraints. */
+	return { const_cast<lookup_slot*>(slots), slots_mask,
+		const_cast<int16_t*>(short_args), const_cast<type*>(types),
+		const_cast<int16_t*>(positionals), positionals_size, variadic_arg };
+}
+
+NS_GETOPT_INLINE int detail::choice_view::find(std::string_view s) const {
+	const int i = slots[choice_slot(s, multiplier, shift)];
+	if (i == -1 || !compare_no_case(s, names[i]))
+		return -1;
+	return i;
+}
+
+NS_GETOPT_INLINE void argument::asserts() {
+	assert(long_arg.find(" ") == std::string_view::npos
+			&& "One does not simply use spaces in his arguments.");
+	assert((aliases_size == 0 || !detail::is_positional(*this))
+			&& "Positional arguments have no aliases.");
+	for (size_t i = 0; i < aliases_size; ++i) {
+		assert(aliases[i].long_arg.find(" ") == std::string_view::npos
+				&& "One does not simply use spaces in his aliases.");
+		assert((!aliases[i].long_arg.empty() || aliases[i].short_arg != '\0')
+				&& "An alias needs a long_arg or a short_arg.");
+	}
+}
+
+NS_GETOPT_INLINE options::options(std::string_view help_intro,
+		std::string_view help_outro, flag flags,
+		const std::function<bool(std::string_view)>& first_argument_func,
+		int exit_code,
+		const std::function<void(const parse_error&)>& error_func,
+		std::pmr::memory_resource* resource)
+		: first_argument_func(first_argument_func)
+		, error_func(error_func)
+		, resource(resource)
+		, help_intro(help_intro)
+		, help_outro(help_outro)
+		, exit_code(exit_code)
+		, flags(flags) {
+}
+
+NS_GETOPT_INLINE void print_help(const argument* args, size_t args_size,
+		const char* arg0, const options& option) {
+	using namespace detail;
+
+	const size_t first_space = 1;
+	const size_t sa_width = 4;
+	const size_t sa_total_width = first_space + sa_width;
+	const size_t la_space = 2;
+	const size_t la_width_max = 30;
+	const size_t ra_space = 4;
+	const std::string_view opt_str = " <optional>";
+	const std::string_view req_str = " <value>";
+	const std::string_view multi_str = " <multiple>";
+	const std::string_view list_str = " <value>...";
+	const std::string_view count_str = "...";
+	const std::string_view default_beg = " <=";
+	const std::string_view default_end = ">";
+
+	printf("%.*s\n", (int)option.help_intro.size(), option.help_intro.data());
+
+	{ /* Usage. */
+		bool args_optional
+				= has_flag(option.flags, flag::arguments_are_optional);
+		stack_string raw_args;
+		bool first = args_optional;
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (x->arg_type == type::raw_arg) {
+				raw_args += (first ? " [" : " ");
+				raw_args += x->long_arg;
+				first = false;
+			}
+		}
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (x->arg_type == type::variadic_arg) {
+				raw_args += (first ? " [" : " ");
+				raw_args += x->long_arg;
+				raw_args += "...";
+				first = false;
+			}
+		}
+		if (args_optional && raw_args.size() > 0) {
+			raw_args += "]";
+		}
+
+		printf("\nUsage: %s%s [options]\n\n", arg0, raw_args.c_str());
+	}
+
+	{ /* Raw args. */
+		bool has_raw_args = false;
+		size_t name_width = 0;
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (!is_positional(*x))
+				continue;
+
+			has_raw_args = true;
+			size_t s = x->long_arg.size() + ra_space;
+			if (s > name_width)
+				name_width = s;
+		}
+
+		if (has_raw_args)
+			printf("Arguments:\n");
+
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (!is_positional(*x))
+				continue;
+			printf("%*s", (int)first_space, "");
+			printf("%-*.*s", (int)name_width, (int)x->long_arg.size(),
+					x->long_arg.data());
+			print_description(x->description, first_space + name_width);
+			print_choices(x->choice, first_space + name_width,
+					!x->description.empty());
+			print_aliases(*x, first_space + name_width,
+					!x->description.empty() || x->choice.size != 0);
+		}
+		if (has_raw_args)
+			printf("\n");
+	}
+
+	{ /* Other args.*/
+		printf("Options:\n");
+		size_t la_width = 0;
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x))
+				continue;
+
+			size_t s = 2 + x->long_arg.size() + la_space;
+			if (x->arg_type == type::optional_arg) {
+				s += opt_str.size();
+			} else if (x->arg_type == type::required_arg) {
+				s += req_str.size();
+			} else if (x->arg_type == type::default_arg) {
+				s += default_beg.size() + x->default_arg.size()
+						+ default_end.size();
+			} else if (x->arg_type == type::multi_arg) {
+				s += multi_str.size();
+			} else if (x->arg_type == type::list_arg) {
+				s += list_str.size();
+			} else if (x->arg_type == type::count_arg) {
+				s += count_str.size();
+			}
+
+			if (s > la_width)
+				la_width = s;
+		}
+
+		if (la_width > la_width_max) {
+			la_width = la_width_max;
+		}
+
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x))
+				continue;
+
+			printf("%*s", (int)first_space, "");
+
+			if (x->short_arg != '\0') {
+				stack_string s_arg;
+				s_arg += "-";
+				s_arg += x->short_arg;
+				s_arg += ",";
+				printf("%-*s", (int)sa_width, s_arg.c_str());
+			} else {
+				printf("%*s", (int)sa_width, "");
+			}
+
+			stack_string la_str;
+			la_str += "--";
+			la_str += x->long_arg;
+			if (x->arg_type == type::optional_arg) {
+				la_str += opt_str;
+			} else if (x->arg_type == type::required_arg) {
+				la_str += req_str;
+			} else if (x->arg_type == type::default_arg) {
+				la_str += default_beg;
+				la_str += x->default_arg;
+				la_str += default_end;
+			} else if (x->arg_type == type::multi_arg) {
+				la_str += multi_str;
+			} else if (x->arg_type == type::list_arg) {
+				la_str += list_str;
+			} else if (x->arg_type == type::count_arg) {
+				la_str += count_str;
+			}
+
+			printf("%-*s", (int)la_width, la_str.c_str());
+
+			// TODO: Verify comparison is still ok (size works as exapected).
+			if (la_str.size() >= la_width) {
+				printf("\n");
+				printf("%*s", (int)(la_width + sa_total_width), "");
+			}
+
+			print_description(x->description, la_width + sa_total_width);
+			print_choices(x->choice, la_width + sa_total_width,
+					!x->description.empty());
+			print_aliases(*x, la_width + sa_total_width,
+					!x->description.empty() || x->choice.size != 0);
+		}
+
+		if (la_width == 0) // No options, width is --help only.
+			la_width = 2 + 4 + la_space;
+
+		printf("%*s%-*s%-*s%s\n", (int)first_space, "", (int)sa_width, "-h,",
+				(int)la_width, "--help", "Print this help\n");
+
+		printf("\n%.*s\n", (int)option.help_outro.size(),
+				option.help_outro.data());
+	}
+}
+
+NS_GETOPT_INLINE void print_completion(
+		const argument* args, size_t args_size, const char* arg0, shell sh) {
+	using namespace detail;
+
+	const std::string_view prog = program_name(arg0);
+	const int prog_size = (int)prog.size();
+
+	switch (sh) {
+	case shell::bash: {
+		/* Function names only accept identifier characters. */
+		stack_string func;
+		for (char c : prog) {
+			func += (std::isalnum((unsigned char)c) ? c : '_');
+		}
+
+		printf("_%s_complete() {\n", func.c_str());
+		printf("\tlocal cur=\"${COMP_WORDS[COMP_CWORD]}\"\n");
+		printf("\tlocal prev=\"${COMP_WORDS[COMP_CWORD-1]}\"\n");
+
+		/* Options taking a value fall back to file completion. */
+		bool has_value_args = false;
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x) || !takes_value(*x))
+				continue;
+
+			printf("%s", has_value_args ? "|" : "\tcase \"$prev\" in\n\t\t");
+			printf("--%.*s", (int)x->long_arg.size(), x->long_arg.data());
+			if (x->short_arg != '\0')
+				printf("|-%c", x->short_arg);
+			has_value_args = true;
+		}
+		if (has_value_args)
+			printf(") return ;;\n\tesac\n");
+
+		printf("\tCOMPREPLY=($(compgen -W \"--help");
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x))
+				continue;
+			printf(" --%.*s", (int)x->long_arg.size(), x->long_arg.data());
+			if (x->short_arg != '\0')
+				printf(" -%c", x->short_arg);
+		}
+		printf("\" -- \"$cur\"))\n}\n");
+		printf("complete -o default -F _%s_complete %.*s\n", func.c_str(),
+				prog_size, prog.data());
+	} break;
+
+	case shell::zsh: {
+		printf("#compdef %.*s\n\n_arguments -s \\\n", prog_size, prog.data());
+		printf("\t'(- *)'{-h,--help}'[Print this help]' \\\n");
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x))
+				continue;
+
+			const int la_size = (int)x->long_arg.size();
+			const char* la = x->long_arg.data();
+			if (is_repeatable(*x)) {
+				/* No exclusion list, they may be given again. */
+				if (x->short_arg != '\0')
+					printf("\t'*'{-%c,--%.*s}'", x->short_arg, la_size, la);
+				else
+					printf("\t'*--%.*s", la_size, la);
+			} else if (x->short_arg != '\0') {
+				printf("\t'(-%c --%.*s)'{-%c,--%.*s}'", x->short_arg, la_size,
+						la, x->short_arg, la_size, la);
+			} else {
+				printf("\t'--%.*s", la_size, la);
+			}
+
+			/* zsh specs are quoted already, strip what would end them. */
+			printf("[");
+			print_script_text(x->description, "'[]:");
+			printf("]");
+			if (x->arg_type == type::required_arg
+					|| x->arg_type == type::list_arg) {
+				printf(":value:_files");
+			} else if (takes_value(*x)) {
+				printf("::value:_files");
+			}
+			printf("' \\\n");
+		}
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (!is_positional(*x))
+				continue;
+			printf("\t'%s:%.*s:_files' \\\n",
+					x->arg_type == type::variadic_arg ? "*:" : ":",
+					(int)x->long_arg.size(), x->long_arg.data());
+		}
+		printf("\t&& return 0\n");
+	} break;
+
+	case shell::fish: {
+		printf("complete -c %.*s -s h -l help -d 'Print this help'\n",
+				prog_size, prog.data());
+		for (const argument* x = args; x < args + args_size; x++) {
+			if (is_positional(*x))
+				continue;
+
+			printf("complete -c %.*s -l %.*s", prog_size, prog.data(),
+					(int)x->long_arg.size(), x->long_arg.data());
+			if (x->short_arg != '\0')
+				printf(" -s %c", x->short_arg);
+			if (x->arg_type == type::required_arg
+					|| x->arg_type == type::multi_arg
+					|| x->arg_type == type::list_arg)
+				printf(" -r");
+			if (!x->description.empty()) {
+				printf(" -d '");
+				print_script_text(x->description, "'");
+				printf("'");
+			}
+			printf("\n");
+		}
+	} break;
+	}
+}
+
+NS_GETOPT_INLINE void detail::argv_storage::push(char const* token) {
+	if (_size < small_size) {
+		_small[_size++] = token;
+		return;
+	}
+	if (_large.empty()) {
+		_large.reserve(small_size * 2);
+		_large.assign(_small.begin(), _small.end());
+	}
+	_large.push_back(token);
+	++_size;
+}
+
+NS_GETOPT_INLINE void detail::argv_storage::clear() {
+	_large.clear();
+	_size = 0;
+}
+
+NS_GETOPT_INLINE char const* const* detail::argv_storage::finish(int& argc) {
+	argc = (int)_size;
+	push(nullptr);
+	return _large.empty() ? _small.data() : _large.data();
+}
+
+NS_GETOPT_INLINE buffer_argv::buffer_argv(
+		std::string_view buffer, std::pmr::memory_resource* resource)
+		: _storage(resource)
+		, _tail(resource) {
+	/* memchr is vectorized by the C library, token boundaries are found
+	 * a register at a time. */
+	const char* p = buffer.data();
+	const char* end = p + buffer.size();
+	while (p < end) {
+		const char* nul = (const char*)memchr(p, '\0', (size_t)(end - p));
+		if (nul == nullptr) {
+			_tail.assign(p, end);
+			_tail.push_back('\0');
+			_storage.push(_tail.data());
+			break;
+		}
+		_storage.push(p);
+		p = nul + 1;
+	}
+	argv = _storage.finish(argc);
+}
+
+NS_GETOPT_INLINE command_argv::command_argv(
+		char* command, std::pmr::memory_resource* resource)
+		: _storage(resource) {
+	using namespace detail;
+
+	auto is_blank = [](char c) {
+		return command_chars[(unsigned char)c] == command_char::blank;
+	};
+	auto is_plain = [](char c) {
+		return command_chars[(unsigned char)c] == command_char::plain;
+	};
+
+	/* Read ahead of write, w == r until something was removed. */
+	char* r = command;
+	char* w = command;
+	auto copy = [&](char* from) {
+		if (w != from)
+			memmove(w, from, (size_t)(r - from));
+		w += r - from;
+	};
+
+	while (true) {
+		while (is_blank(*r)) {
+			++r;
+		}
+		if (*r == '\0')
+			break;
+
+		char* token = r;
+		w = r;
+		while (true) {
+			char* run = r;
+			while (is_plain(*r)) {
+				++r;
+			}
+			copy(run);
+
+			if (*r == '\'') {
+				run = ++r;
+				while (*r != '\0' && *r != '\'') {
+					++r;
+				}
+				if (*r == '\0') {
+					error = command_error::unterminated_quote;
+					break;
+				}
+				copy(run);
+				++r;
+			} else if (*r == '"') {
+				++r;
+				while (true) {
+					run = r;
+					while (*r != '\0' && *r != '"' && *r != '\\') {
+						++r;
+					}
+					copy(run);
+					if (*r != '\\')
+						break;
+
+					/* Only escapes what is special in double quotes. */
+					const char next = r[1];
+					if (next == '\n') {
+						r += 2;
+					} else if (next == '"' || next == '\\' || next == '$'
+							|| next == '`') {
+						*w++ = next;
+						r += 2;
+					} else {
+						*w++ = *r++;
+					}
+				}
+				if (*r == '\0') {
+					error = command_error::unterminated_quote;
+					break;
+				}
+				++r;
+			} else if (*r == '\\') {
+				if (r[1] == '\0') {
+					error = command_error::trailing_backslash;
+					break;
+				}
+				if (r[1] != '\n')
+					*w++ = r[1];
+				r += 2;
+			} else {
+				break;
+			}
+		}
+		if (error != command_error::none)
+			break;
+
+		/* w never passes r, terminating can't clobber unread text. */
+		const char end = *r;
+		*w = '\0';
+		_storage.push(token);
+		if (end == '\0')
+			break;
+		++r;
+	}
+
+	if (error != command_error::none)
+		_storage.clear();
+	argv = _storage.finish(argc);
+}
+
+NS_GETOPT_INLINE early_exit prescan(
+		int argc, char const* const* argv, const options& option) {
+	using namespace detail;
+
+	const int first
+			= has_flag(option.flags, flag::arg0_is_normal_argument) ? 0 : 1;
+	if (argc <= first)
+		return early_exit::none;
+
+	const char* arg = argv[first];
+	if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0
+			|| strcmp(arg, "/?") == 0)
+		return early_exit::help;
+	if (strcmp(arg, "--version") == 0)
+		return early_exit::version;
+	if (has_flag(option.flags, flag::enable_completion)
+			&& strcmp(arg, "__complete") == 0)
+		return early_exit::completion;
+	return early_exit::none;
+}
+
+NS_GETOPT_INLINE event_parser::event_parser(int argc,
+		char const* const* argv, argument* args, size_t args_size,
+		const detail::lookup_table& table, const options& option)
+		: _table(table)
+		, _list_values(option.resource)
+		, _parser(argc, argv, args, args_size, _table, option, _list_values) {
+	for (argument* x = args; x < args + args_size; x++) {
+		x->parsed = false;
+	}
+}
+
+NS_GETOPT_INLINE bool event_parser::next(option_event& ev) {
+	detail::parse_event pe{};
+	if (!_parser.next(pe))
+		return false;
+
+	ev.id = pe.arg_index;
+	ev.argv_index = pe.argv_index;
+	ev.value = pe.value;
+	ev.values = { pe.values, (size_t)pe.values_count };
+	ev.count = pe.count;
+	return true;
+}
+
+/* Internal functions. */
+namespace detail {
+
+NS_GETOPT_INLINE bool parse_tokens(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		const options& option, event_sink sink,
+		std::pmr::vector<char const*>& list_values) {
+	/* Shell completion, runs no callbacks. */
+	const int arg0_offset
+			= has_flag(option.flags, flag::arg0_is_normal_argument) ? 0 : 1;
+	if (has_flag(option.flags, flag::enable_completion)
+			&& argc > arg0_offset
+			&& strcmp(argv[arg0_offset], "__complete") == 0) {
+		complete(args, args_size, argc - arg0_offset - 1,
+				argv + arg0_offset + 1,
+				[](std::string_view dashes, std::string_view name) {
+					printf("%.*s%.*s\n", (int)dashes.size(), dashes.data(),
+							(int)name.size(), name.data());
+				});
+
+		if (has_flag(option.flags, flag::exit_on_error))
+			exit(0);
+		return false;
+	}
+
+	token_parser parser(
+			argc, argv, args, args_size, table, option, list_values);
+	parse_event ev{};
+	while (parser.next(ev)) {
+		if (!sink(ev)) {
+			maybe_print_msg(
+					option, callback_error_msg(args[ev.arg_index], ev));
+			return parser.fail();
+		}
+	}
+	return !parser.failed;
+}
+
+NS_GETOPT_INLINE token_parser::token_parser(int argc,
+		char const* const* argv, argument* args, size_t args_size,
+		const lookup_table& table, const options& option,
+		std::pmr::vector<char const*>& list_values)
+		: argc(argc)
+		, argv(argv)
+		, args(args)
+		, args_size(args_size)
+		, table(table)
+		, option(option)
+		, list_values(list_values)
+		, index(option.resource)
+		, repeats(option.resource) {
+	for (int j = 0; j < table.positionals_size; ++j) {
+		args[table.positionals[j]].raw_arg_pos = j;
+	}
+
+	if (table.constraints != nullptr) {
+		std::fill(table.present, table.present + table.constraints->words,
+				uint64_t(0));
+	}
+}
+
+NS_GETOPT_INLINE bool token_parser::next(parse_event& ev) {
+	/* Locals, or every store to ev or args would reload them. */
+	const int argc = this->argc;
+	char const* const* const argv = this->argv;
+	argument* const args = this->args;
+	const lookup_table& table = this->table;
+	const options& option = this->option;
+
+	while (!done) {
+		if (shorts_next < shorts_size) {
+			const int x = shorts[shorts_next++];
+			ev = { x, shorts_argv_index, -1, 0, {} };
+			if (args[x].arg_type == type::default_arg)
+				ev.value = args[x].default_arg;
+		} else if (next_token < argc) {
+			/* One token, values move i along. Tokens producing no event
+			 * continue from the top. */
+			int i = next_token;
+			/* Measured once, long tokens must not cost a strlen per lookup. */
+			const std::string_view token = argv[i];
+
+			/* First argument is a special snowflake. */
+			if (i == 0
+					&& !has_flag(option.flags, flag::arg0_is_normal_argument)) {
+				if (argc == 1
+						&& !has_flag(
+								option.flags, flag::arguments_are_optional)) {
+					return fail();
+				} else {
+					option.first_argument_func(argv[i]);
+				}
+				next_token = i + 1;
+				continue;
+			}
+
+			/* Terminator. */
+			else if (!options_ended && token == "--") {
+				options_ended = true;
+				next_token = i + 1;
+				continue;
+			}
+
+			/* Help. */
+			else if (!options_ended
+					&& (strcmp(argv[i], "-h") == 0
+							|| strcmp(argv[i], "--help") == 0
+							|| strcmp(argv[i], "/?") == 0)) {
+				return fail();
+			}
+
+			/* Check single short arg and long args. */
+			else if (!options_ended
+					&& ((strncmp(argv[i], "-", 1) == 0 && token.size() == 2)
+							|| strncmp(argv[i], "--", 2) == 0)) {
+				int found = table.find_long(token.substr(2), args);
+				if (found == -1) {
+					found = table.find_short(token[1]);
+				}
+
+				/* Abbreviations and suggestions. The index is only built when
+				 * exact matching failed. */
+				if (found == -1 && token.size() > 2 && token[1] == '-') {
+					const bool abbreviate
+							= has_flag(option.flags, flag::allow_abbreviations);
+					const bool suggest = !has_flag(
+							option.flags, flag::no_user_error_messages);
+					if ((abbreviate || suggest) && !index_built) {
+						index.build(args, args_size);
+						index_built = true;
+					}
+
+					if (abbreviate) {
+						found = index.match_prefix(token.substr(2));
+					}
+
+					if (found == trie::ambiguous) {
+						int candidates[trie::max_candidates];
+						size_t count = index.prefix_candidates(token.substr(2),
+								candidates, trie::max_candidates);
+						stack_string msg = make_stack_string(
+								"'", argv[i], "' is ambiguous :");
+						for (size_t j = 0; j < count; ++j) {
+							msg += " --";
+							msg += args[candidates[j]].long_arg;
+						}
+						maybe_print_msg(option, msg);
+						return fail();
+					}
+
+					if (found == trie::not_found && suggest) {
+						int candidates[trie::max_candidates];
+						size_t count = index.suggest(token.substr(2),
+								trie::max_distance, candidates,
+								trie::max_candidates);
+						stack_string msg = make_stack_string(
+								"'", argv[i], "' not found.");
+						for (size_t j = 0; j < count; ++j) {
+							msg += (j == 0 ? " Did you mean '--" : "' or '--");
+							msg += args[candidates[j]].long_arg;
+						}
+						if (count != 0) {
+							msg += "'?";
+						}
+						maybe_print_msg(option, msg);
+						return fail();
+					}
+				}
+
+				if (found == -1) {
+					maybe_print_msg(option,
+							make_stack_string("'", argv[i], "' not found."));
+					return fail();
+				}
+
+				if (args[found].aliases_size != 0) {
+					print_deprecation(args[found], token, option);
+				}
+
+				if (table.types[found] == type::count_arg) {
+					repeats.push_back({ found, i });
+					next_token = i + 1;
+					continue;
+				}
+
+				if (args[found].parsed) {
+					maybe_print_msg(option,
+							make_stack_string(
+									"'", argv[i], "' already parsed."));
+					return fail();
+				}
+
+				argument& found_arg = args[found];
+				ev = { found, i, -1, 0, {} };
+
+				switch (found_arg.arg_type) {
+				case type::no_arg: {
+				} break;
+
+				case type::required_arg:
+				case type::list_arg: {
+					if (i + 1 >= argc || strncmp(argv[i + 1], "-", 1) == 0) {
+						maybe_print_msg(option,
+								make_stack_string("'", argv[i],
+										"' requires 1 argument."));
+						return fail();
+					}
+					if (found_arg.arg_type == type::list_arg) {
+						repeats.push_back({ found, ++i });
+						next_token = i + 1;
+						continue;
+					}
+					ev.values_index = ++i;
+					ev.values_count = 1;
+					ev.value = argv[i];
+				} break;
+
+				case type::optional_arg:
+				case type::default_arg: {
+					if (i + 1 >= argc || strncmp(argv[i + 1], "-", 1) == 0) {
+						if (found_arg.arg_type == type::default_arg)
+							ev.value = found_arg.default_arg;
+						break;
+					}
+					ev.values_index = ++i;
+					ev.values_count = 1;
+					ev.value = argv[i];
+				} break;
+
+				case type::multi_arg: {
+					while (i + 1 < argc) {
+						// Found next option. Stop parsing.
+						if (strncmp(argv[i + 1], "-", 1) == 0) {
+							break;
+						}
+
+						// Check before storing, values are handed over in a
+						// multi_array.
+						if ((size_t)ev.values_count
+								>= found_arg.multi_max_len) {
+							char buf[24] = {};
+							snprintf(buf, sizeof(buf), "%zu",
+									found_arg.multi_max_len);
+							maybe_print_msg(option,
+									make_stack_string("'", found_arg.long_arg,
+											"' only supports ", buf,
+											" arguments."));
+							return fail();
+						}
+
+						if (ev.values_count == 0)
+							ev.values_index = i + 1;
+						++ev.values_count;
+						++i;
+					}
+				} break;
+
+				default: {
+					// assert(false && "Something went horribly wrong.");
+					maybe_print_msg(option,
+							make_stack_string("problem parsing options."));
+					return fail();
+				};
+				}
+
+			}
+
+			/* Concatenated short args. */
+			else if (!options_ended && strncmp(argv[i], "-", 1) == 0
+					&& token.size() > 2) {
+				/* Accept duplicate flags because who cares. Duplicate chars are
+				 * dropped here, aliases of one argument after sorting. */
+				std::array<int, 256>& found_v = shorts;
+				std::array<bool, 256> seen{};
+				size_t found_size = 0;
+				bool counted = false;
+				stack_string not_found;
+				for (size_t j = 1; j < token.size(); ++j) {
+					int found = table.find_short(token[j]);
+					if (found == -1) {
+						not_found += token[j];
+						continue;
+					}
+					if (args[found].aliases_size != 0) {
+						const char spelling[] = { '-', token[j] };
+						print_deprecation(args[found],
+								std::string_view(spelling, 2), option);
+					}
+					/* Counters count every occurrence, -vvv is 3. */
+					if (table.types[found] == type::count_arg) {
+						repeats.push_back({ found, i });
+						counted = true;
+						continue;
+					}
+					if (!seen[(unsigned char)token[j]]) {
+						seen[(unsigned char)token[j]] = true;
+						found_v[found_size++] = found;
+					}
+				}
+
+				if (found_size == 0 && !counted) {
+					maybe_print_msg(option,
+							make_stack_string("'", argv[i], "' not found."));
+					return fail();
+				}
+
+				if (not_found.size() != 0) {
+					maybe_print_msg(option,
+							make_stack_string(
+									"'", not_found.c_str(), "' not found."));
+					return fail();
+				}
+
+				/* Callbacks are executed in declaration order. */
+				std::sort(found_v.begin(), found_v.begin() + found_size);
+				found_size = size_t(std::unique(found_v.begin(),
+											 found_v.begin() + found_size)
+						- found_v.begin());
+
+				for (size_t j = 0; j < found_size; ++j) {
+					const auto& x = found_v[j];
+					if (args[x].parsed) {
+						maybe_print_msg(option,
+								make_stack_string("'", args[x].short_arg,
+										"' already parsed."));
+						return fail();
+					}
+
+					if (!(table.types[x] == type::no_arg
+								|| table.types[x] == type::optional_arg
+								|| table.types[x] == type::default_arg)) {
+
+						maybe_print_msg(option,
+								make_stack_string("'", args[x].short_arg,
+										"' unsupported in concatenated short "
+										"arguments."));
+						return fail();
+					}
+				}
+
+				/* Handed out one at a time, from the top of the loop. */
+				shorts_argv_index = i;
+				shorts_size = found_size;
+				shorts_next = 0;
+				next_token = i + 1;
+				continue;
+			}
+
+			/* Check raw args. */
+			else if (parsed_raw_args < table.positionals_size) {
+				const int found = table.positionals[parsed_raw_args++];
+				ev = { found, i, i, 1, argv[i] };
+			}
+
+			/* Variadic arg, everything left goes to it as is. */
+			else if (table.variadic_arg != -1) {
+				ev = { table.variadic_arg, i, i, argc - i, argv[i] };
+				i = argc;
+			}
+
+			/* Everything failed. */
+			else {
+				maybe_print_msg(option,
+						make_stack_string("'", argv[i], "' unrecognized."));
+				return fail();
+			}
+			next_token = i + 1;
+		} else if (!tokens_read) {
+			/* Repeated arguments, one event each in declaration order.
+			 * list_arg values are gathered contiguously, sized once so
+			 * events can point in list_values. */
+			std::sort(repeats.begin(), repeats.end(),
+					[](const repeat& lhs, const repeat& rhs) {
+						return lhs.arg_index != rhs.arg_index
+								? lhs.arg_index < rhs.arg_index
+								: lhs.argv_index < rhs.argv_index;
+					});
+			list_values.clear();
+			list_values.reserve(repeats.size());
+			tokens_read = true;
+			continue;
+		} else if (next_repeat < repeats.size()) {
+			size_t j = next_repeat;
+			const int x = repeats[j].arg_index;
+			size_t end = j;
+			while (end < repeats.size() && repeats[end].arg_index == x) {
+				++end;
+			}
+
+			ev = { x, repeats[j].argv_index, -1, 0, {} };
+			ev.count = (int)(end - j);
+			if (table.types[x] == type::list_arg) {
+				ev.argv_index -= 1;
+				ev.values = list_values.data() + list_values.size();
+				ev.values_count = ev.count;
+				for (; j < end; ++j) {
+					list_values.push_back(argv[repeats[j].argv_index]);
+				}
+				ev.value = list_values.back();
+			}
+			next_repeat = end;
+		} else {
+			done = true;
+			if (table.constraints != nullptr
+					&& !check_constraints(
+							args, *table.constraints, table.present, option))
+				return fail();
+			return false;
+		}
+
+		/* Found one, check it before handing it over. */
+		args[ev.arg_index].parsed = true;
+		if (table.constraints != nullptr) {
+			table.present[ev.arg_index / 64] |= uint64_t(1)
+					<< (ev.arg_index % 64);
+		}
+		if (ev.values == nullptr && ev.values_index >= 0)
+			ev.values = argv + ev.values_index;
+		if (!check_value(args, ev, option))
+			return fail();
+		return true;
+	}
+	return false;
+}
+
+NS_GETOPT_INLINE bool token_parser::fail() {
+	done = true;
+	failed = true;
+	return do_exit(args, args_size, option, argv[0]);
+}
+
+NS_GETOPT_INLINE bool parse_and_dispatch(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		parse_event* events, const options& option) {
+	if (!has_flag(option.flags, flag::deferred_callbacks)) {
+		immediate_dispatch dispatch{ args, argv };
+		std::pmr::vector<char const*> list_values(option.resource);
+		return parse_tokens(argc, argv, args, args_size, table, option,
+				make_sink(dispatch), list_values);
+	}
+
+	/* Parse and validate everything first. */
+	event_list list{ events, 0 };
+	std::pmr::vector<char const*> list_values(option.resource);
+	if (!parse_tokens(argc, argv, args, args_size, table, option,
+				make_sink(list), list_values))
+		return false;
+
+	return dispatch_events(args, args_size, events, list.size, argv, option);
+}
+
+NS_GETOPT_INLINE bool parse_into(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		parse_result& result, const options& option) {
+	assert(result.size >= args_size && "parse_result buffer too small.");
+
+	/* Made to be called repeatedly, forget the previous parse. */
+	for (argument* x = args; x < args + args_size; x++) {
+		x->parsed = false;
+	}
+
+	result.clear();
+	result.argv = argv;
+	result_store store{ result.data };
+	return parse_tokens(argc, argv, args, args_size, table, option,
+			make_sink(store), result.list_values);
+}
+
+NS_GETOPT_INLINE void lookup_table::build(
+		const argument* args, size_t args_size) {
+	std::fill(slots, slots + slots_mask + 1, lookup_slot{ 0, -1, -1 });
+	std::fill(short_args, short_args + 256, int16_t(-1));
+	positionals_size = 0;
+	variadic_arg = -1;
+	overflow_begin = 0;
+	overflow_end = 0;
+
+	/* One slot stays empty, so probes end. The other slots outnumber the
+	 * arguments, only aliases can run out. */
+	size_t free_slots = slots_mask;
+	auto insert = [&](std::string_view name, size_t i, int alias) {
+		const uint32_t hash = hash_no_case(name);
+		for (size_t s = hash & slots_mask;; s = (s + 1) & slots_mask) {
+			if (slots[s].arg_index == -1) {
+				if (free_slots == 0)
+					return false;
+				--free_slots;
+				slots[s] = { hash, (int16_t)i, (int16_t)alias };
+				return true;
+			}
+			if (slots[s].hash == hash
+					&& compare_no_case(name, slot_name(slots[s], args)))
+				return true;
+		}
+	};
+
+	for (size_t i = 0; i < args_size; ++i) {
+		const argument& a = args[i];
+		types[i] = a.arg_type;
+
+		if (a.arg_type == type::raw_arg) {
+			positionals[positionals_size++] = (int16_t)i;
+			continue;
+		}
+		if (a.arg_type == type::variadic_arg) {
+			assert(variadic_arg == -1 && "Only one variadic_arg is allowed.");
+			if (variadic_arg == -1)
+				variadic_arg = (int16_t)i;
+			continue;
+		}
+
+		/* First declared wins, like a linear scan would. */
+		if (a.short_arg != '\0' && short_args[(unsigned char)a.short_arg] == -1)
+			short_args[(unsigned char)a.short_arg] = (int16_t)i;
+
+		if (!a.long_arg.empty())
+			insert(a.long_arg, i, -1);
+	}
+
+	/* Aliases after every declared name, so they can't crowd one out and
+	 * never shadow one. */
+	for (size_t i = 0; i < args_size; ++i) {
+		const argument& a = args[i];
+		if (is_positional(a))
+			continue;
+
+		for (size_t j = 0; j < a.aliases_size; ++j) {
+			const alias& al = a.aliases[j];
+			if (al.short_arg != '\0'
+					&& short_args[(unsigned char)al.short_arg] == -1)
+				short_args[(unsigned char)al.short_arg] = (int16_t)i;
+
+			if (!al.long_arg.empty() && !insert(al.long_arg, i, (int)j)) {
+				if (overflow_end == 0)
+					overflow_begin = (int16_t)i;
+				overflow_end = (int16_t)(i + 1);
+			}
+		}
+	}
+}
+
+NS_GETOPT_INLINE int lookup_table::find_long(
+		std::string_view name, const argument* args) const {
+	if (name.empty())
+		return -1;
+
+	const uint32_t hash = hash_no_case(name);
+	for (size_t s = hash & slots_mask; slots[s].arg_index != -1;
+			s = (s + 1) & slots_mask) {
+		if (slots[s].hash == hash
+				&& compare_no_case(name, slot_name(slots[s], args)))
+			return slots[s].arg_index;
+	}
+
+	for (int i = overflow_begin; i < overflow_end; ++i) {
+		for (size_t j = 0; j < args[i].aliases_size; ++j) {
+			if (compare_no_case(name, args[i].aliases[j].long_arg))
+				return i;
+		}
+	}
+	return -1;
+}
+
+NS_GETOPT_INLINE int lookup_table::find_short(char c) const {
+	if (c == '\0')
+		return -1;
+	return short_args[(unsigned char)c];
+}
+
+NS_GETOPT_INLINE void trie::build(
+		const argument* args, size_t args_size, std::string_view prefix) {
+	auto indexed = [&](const argument& a) {
+		return !is_positional(a) && !a.long_arg.empty()
+				&& a.long_arg.size() >= prefix.size()
+				&& std::equal(prefix.begin(), prefix.end(),
+						a.long_arg.begin(), char_compare_no_case);
+	};
+
+	/* At most one node per character, allocate once. */
+	size_t chars = 0;
+	for (size_t i = 0; i < args_size; ++i) {
+		if (indexed(args[i]))
+			chars += args[i].long_arg.size();
+	}
+	nodes.clear();
+	nodes.reserve(chars + 1);
+	nodes.push_back(node{});
+	max_depth = 0;
+
+	for (size_t i = 0; i < args_size; ++i) {
+		const argument& a = args[i];
+		if (!indexed(a))
+			continue;
+
+		int n = 0;
+		for (char c : a.long_arg) {
+			unsigned char lc = to_lower(c);
+			int child = find_child(n, lc);
+			if (child == not_found)
+				child = insert_child(n, lc);
+			n = child;
+
+			int& unique = nodes[n].unique_arg;
+			unique = (unique == not_found || unique == (int)i) ? (int)i
+															   : ambiguous;
+		}
+
+		if (nodes[n].arg_index == not_found)
+			nodes[n].arg_index = (int)i;
+		max_depth = std::max(max_depth, a.long_arg.size());
+	}
+}
+
+NS_GETOPT_INLINE int trie::match_prefix(std::string_view s) const {
+	int n = find_node(s);
+	if (n <= 0)
+		return not_found;
+	if (nodes[n].arg_index != not_found)
+		return nodes[n].arg_index;
+	return nodes[n].unique_arg;
+}
+
+NS_GETOPT_INLINE size_t trie::prefix_candidates(
+		std::string_view s, int* out, size_t out_size) const {
+	size_t count = 0;
+	if (s.empty())
+		return count;
+
+	for_each_prefixed(s, [&](int arg_index) {
+		if (count == out_size)
+			return false;
+		out[count++] = arg_index;
+		return true;
+	});
+	return count;
+}
+
+NS_GETOPT_INLINE size_t trie::suggest(std::string_view s, size_t max_dist,
+		int* out, size_t out_size) const {
+	/* Nothing can be close enough, don't bother (or allocate). */
+	if (nodes.empty() || s.size() > max_depth + max_dist)
+		return 0;
+
+	/* One edit distance row per trie depth. */
+	const size_t cols = s.size() + 1;
+	std::pmr::vector<size_t> rows(
+			cols * (max_depth + 1), nodes.get_allocator().resource());
+	for (size_t j = 0; j < cols; ++j) {
+		rows[j] = j;
+	}
+
+	size_t out_dist[max_candidates];
+	size_t count = 0;
+	out_size = std::min(out_size, max_candidates);
+	suggest(0, 0, s, max_dist, rows, out, out_dist, out_size, count);
+	return count;
+}
+
+NS_GETOPT_INLINE int trie::find_child(int n, unsigned char c) const {
+	for (int child = nodes[n].first_child; child != -1;
+			child = nodes[child].next_sibling) {
+		if (nodes[child].ch == c)
+			return child;
+		if (nodes[child].ch > c)
+			break;
+	}
+	return not_found;
+}
+
+NS_GETOPT_INLINE int trie::insert_child(int n, unsigned char c) {
+	node new_node;
+	new_node.ch = c;
+	int idx = (int)nodes.size();
+
+	int prev = -1;
+	int next = nodes[n].first_child;
+	while (next != -1 && nodes[next].ch < c) {
+		prev = next;
+		next = nodes[next].next_sibling;
+	}
+	new_node.next_sibling = next;
+	nodes.push_back(new_node);
+
+	if (prev == -1) {
+		nodes[n].first_child = idx;
+	} else {
+		nodes[prev].next_sibling = idx;
+	}
+	return idx;
+}
+
+NS_GETOPT_INLINE int trie::find_node(std::string_view s) const {
+	if (nodes.empty())
+		return not_found;
+
+	int n = 0;
+	for (char c : s) {
+		n = find_child(n, to_lower(c));
+		if (n == not_found)
+			return not_found;
+	}
+	return n;
+}
+
+NS_GETOPT_INLINE void trie::suggest(int n, size_t depth, std::string_view s,
+		size_t max_dist, std::pmr::vector<size_t>& rows, int* out,
+		size_t* out_dist, size_t out_size, size_t& count) const {
+	const size_t cols = s.size() + 1;
+
+	for (int child = nodes[n].first_child; child != -1;
+			child = nodes[child].next_sibling) {
+		const size_t* prev = &rows[depth * cols];
+		size_t* row = &rows[(depth + 1) * cols];
+		const unsigned char c = nodes[child].ch;
+
+		row[0] = prev[0] + 1;
+		size_t row_min = row[0];
+		for (size_t j = 1; j < cols; ++j) {
+			size_t cost = to_lower(s[j - 1]) == c ? 0 : 1;
+			row[j] = std::min(
+					{ prev[j] + 1, row[j - 1] + 1, prev[j - 1] + cost });
+			row_min = std::min(row_min, row[j]);
+		}
+
+		/* Keep the closest, sorted by distance. */
+		const size_t dist = row[cols - 1];
+		if (nodes[child].arg_index != not_found && dist <= max_dist) {
+			size_t pos = count;
+			while (pos > 0 && out_dist[pos - 1] > dist) {
+				--pos;
+			}
+			if (pos < out_size) {
+				size_t last = std::min(count, out_size - 1);
+				for (size_t k = last; k > pos; --k) {
+					out[k] = out[k - 1];
+					out_dist[k] = out_dist[k - 1];
+				}
+				out[pos] = nodes[child].arg_index;
+				out_dist[pos] = dist;
+				count = std::min(count + 1, out_size);
+			}
+		}
+
+		/* Every row entry only grows deeper down, prune. */
+		if (row_min <= max_dist) {
+			suggest(child, depth + 1, s, max_dist, rows, out, out_dist,
+					out_size, count);
+		}
+	}
+}
+
+NS_GETOPT_INLINE bool invoke_callback(
+		const argument& arg, const parse_event& ev) {
+	switch (arg.arg_type) {
+	case type::no_arg: {
+		return arg.no_arg_func();
+	}
+	case type::multi_arg: {
+		multi_array a;
+		for (int i = 0; i < ev.values_count; ++i) {
+			a[i] = ev.values[i];
+		}
+		return arg.multi_arg_func(a, ev.values_count);
+	}
+	case type::variadic_arg:
+	case type::list_arg: {
+		return arg.span_arg_func({ ev.values, (size_t)ev.values_count });
+	}
+	case type::count_arg: {
+		return arg.count_arg_func((size_t)ev.count);
+	}
+	default: {
+		return arg.one_arg_func(ev.value);
+	}
+	}
+}
+
+NS_GETOPT_INLINE stack_string callback_error_msg(
+		const argument& arg, const parse_event& ev) {
+	if (is_positional(arg)) {
+		return make_stack_string(
+				"'", ev.value, "' problem parsing argument.");
+	}
+	return make_stack_string(
+			"'--", arg.long_arg, "' problem parsing argument.");
+}
+
+NS_GETOPT_INLINE bool result_store::operator()(const parse_event& ev) {
+	data[ev.arg_index] = { ev.argv_index, ev.values_index, ev.values_count,
+		ev.value, ev.values, ev.count };
+	return true;
+}
+
+NS_GETOPT_INLINE bool immediate_dispatch::operator()(const parse_event& ev) {
+	return invoke_callback(args[ev.arg_index], ev);
+}
+
+NS_GETOPT_INLINE bool event_list::operator()(const parse_event& ev) {
+	data[size++] = ev;
+	return true;
+}
+
+NS_GETOPT_INLINE void sort_by_phase(const argument* args, parse_event* events,
+		size_t events_size, std::pmr::memory_resource* resource) {
+	auto phase = [&](size_t i) { return args[events[i].arg_index].phase; };
+
+	bool sorted = true;
+	for (size_t i = 1; i < events_size && sorted; ++i) {
+		sorted = phase(i - 1) <= phase(i);
+	}
+	if (sorted)
+		return;
+
+	/* Counting sort, stable. std::stable_sort would get its buffer from
+	 * the global allocator. */
+	std::array<size_t, 257> starts{};
+	for (size_t i = 0; i < events_size; ++i) {
+		++starts[phase(i) + 1];
+	}
+	for (size_t p = 1; p < starts.size(); ++p) {
+		starts[p] += starts[p - 1];
+	}
+
+	std::pmr::vector<parse_event> out(events_size, parse_event{}, resource);
+	for (size_t i = 0; i < events_size; ++i) {
+		out[starts[phase(i)]++] = events[i];
+	}
+	std::copy(out.begin(), out.end(), events);
+}
+
+NS_GETOPT_INLINE bool dispatch_events(const argument* args, size_t args_size,
+		parse_event* events, size_t events_size, char const* const* argv,
+		const options& option) {
+	sort_by_phase(args, events, events_size, option.resource);
+
+	for (size_t phase_beg = 0; phase_beg < events_size;) {
+		const unsigned char phase = args[events[phase_beg].arg_index].phase;
+		size_t phase_end = phase_beg;
+		size_t independent_count = 0;
+		while (phase_end < events_size
+				&& args[events[phase_end].arg_index].phase == phase) {
+			if (args[events[phase_end].arg_index].independent)
+				++independent_count;
+			++phase_end;
+		}
+
+		/* Index of the first failed event, in argv order. */
+		std::atomic<size_t> failed{ events_size };
+		auto fail = [&](size_t idx) {
+			size_t prev = failed.load();
+			while (idx < prev && !failed.compare_exchange_weak(prev, idx)) {
+			}
+		};
+
+		/* Independent callbacks are pulled by a pool of workers, which
+		 * the calling thread joins once it is done with the sequential
+		 * ones. */
+		std::atomic<size_t> next{ phase_beg };
+		auto work = [&]() {
+			for (size_t j; (j = next.fetch_add(1)) < phase_end;) {
+				if (failed.load() != events_size)
+					return;
+
+				const parse_event& ev = events[j];
+				if (!args[ev.arg_index].independent)
+					continue;
+				if (!invoke_callback(args[ev.arg_index], ev))
+					fail(j);
+			}
+		};
+
+		/* Threads allocate their own state, outside of option.resource. */
+		std::pmr::vector<std::thread> pool(option.resource);
+		if (independent_count > 1) {
+			size_t hw = std::max(std::thread::hardware_concurrency(), 2u);
+			size_t workers = std::min(independent_count, hw) - 1;
+			pool.reserve(workers);
+			for (size_t j = 0; j < workers; ++j) {
+				pool.emplace_back(work);
+			}
+		}
+
+		for (size_t j = phase_beg; j < phase_end; ++j) {
+			const parse_event& ev = events[j];
+			if (args[ev.arg_index].independent)
+				continue;
+			if (!invoke_callback(args[ev.arg_index], ev)) {
+				fail(j);
+				break;
+			}
+		}
+
+		work();
+		for (std::thread& t : pool) {
+			t.join();
+		}
+
+		if (failed.load() != events_size) {
+			const parse_event& ev = events[failed.load()];
+			maybe_print_msg(option, callback_error_msg(args[ev.arg_index], ev));
+			return do_exit(args, args_size, option, argv[0]);
+		}
+		phase_beg = phase_end;
+	}
+	return true;
+}
+
+NS_GETOPT_INLINE void print_description(
+		std::string_view s, size_t indentation) {
+	if (s.size() == 0)
+		return;
+
+	// There is no \n.
+	if (s.find('\n') == std::string_view::npos) {
+		printf("%.*s\n", (int)s.size(), s.data());
+		return;
+	}
+
+	size_t pos = 0;
+	for (size_t found_pos;
+			(found_pos = s.find('\n', pos)) != std::string_view::npos;) {
+		std::string_view out = s.substr(pos, found_pos - pos);
+		printf("%.*s\n", (int)out.size(), out.data());
+		pos = found_pos + 1;
+
+		// Look ahead.
+		if (s.find('\n', pos) != std::string_view::npos) {
+			printf("%*s", (int)indentation, "");
+		}
+	}
+
+	// Still text left to print.
+	if (pos < s.size()) {
+		printf("%*s", (int)indentation, "");
+		std::string_view out = s.substr(pos, s.size() - pos);
+		printf("%.*s\n", (int)out.size(), out.data());
+	}
+}
+
+NS_GETOPT_INLINE void print_script_text(
+		std::string_view s, std::string_view skip_chars) {
+	s = s.substr(0, s.find('\n'));
+	for (char c : s) {
+		if (skip_chars.find(c) != std::string_view::npos)
+			continue;
+		printf("%c", c);
+	}
+}
+
+NS_GETOPT_INLINE std::string_view program_name(const char* arg0) {
+	std::string_view ret = arg0;
+	size_t pos = ret.find_last_of("/\\");
+	if (pos != std::string_view::npos)
+		ret = ret.substr(pos + 1);
+	return ret;
+}
+
+NS_GETOPT_INLINE bool takes_value(const argument& arg) {
+	return arg.arg_type == type::required_arg
+			|| arg.arg_type == type::optional_arg
+			|| arg.arg_type == type::default_arg
+			|| arg.arg_type == type::multi_arg
+			|| arg.arg_type == type::list_arg;
+}
+
+NS_GETOPT_INLINE bool is_repeatable(const argument& arg) {
+	return arg.arg_type == type::count_arg || arg.arg_type == type::list_arg;
+}
+
+NS_GETOPT_INLINE bool is_positional(const argument& arg) {
+	return arg.arg_type == type::raw_arg || arg.arg_type == type::variadic_arg;
+}
+
+NS_GETOPT_INLINE bool do_exit(const argument* args, size_t args_size,
+		const options& option, const char* arg0) {
+	if (!has_flag(option.flags, flag::dont_print_help)) {
+		print_help(args, args_size, arg0, option);
+	}
+
+	if (has_flag(option.flags, flag::exit_on_error))
+		exit(option.exit_code);
+	return false;
+}
+
+NS_GETOPT_INLINE bool check_value(const argument* args,
+		const parse_event& ev, const options& option) {
+	const argument& arg = args[ev.arg_index];
+	if (arg.choice.size == 0 && arg.validators_size == 0)
+		return true;
+
+	/* Every value, or the single one which may be a default. */
+	const int count = ev.values_count > 0 ? ev.values_count : 1;
+	for (int i = 0; i < count; ++i) {
+		parse_error err{ error::invalid_choice, ev.arg_index, -1,
+			ev.values_count > 0 ? ev.values[i] : ev.value };
+		if (ev.values_count > 0 && ev.values_index >= 0)
+			err.argv_index = ev.values_index + i;
+		if (ev.values_count == 0 && err.value.empty())
+			return true; // Nothing given.
+
+		if (arg.choice.size != 0 && arg.choice.find(err.value) == -1) {
+			report_value_error(arg, err, option);
+			return false;
+		}
+		for (size_t j = 0; j < arg.validators_size; ++j) {
+			if (!run_validator(arg.validators[j], err.value, err.kind)) {
+				err.failed = &arg.validators[j];
+				report_value_error(arg, err, option);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+NS_GETOPT_INLINE bool run_validator(
+		const validator& v, std::string_view value, error& why) {
+	switch (v.kind) {
+	case validator::check::in_range: {
+		const char* first = value.data();
+		const char* last = value.data() + value.size();
+		if (first != last && *first == '+')
+			++first;
+		int64_t n = 0;
+		const std::from_chars_result r = std::from_chars(first, last, n);
+		const bool overflow = r.ec == std::errc::result_out_of_range;
+		if (first == last || r.ptr != last
+				|| (r.ec != std::errc() && !overflow)) {
+			why = error::not_a_number;
+			return false;
+		}
+		if (overflow || n < v.min || n > v.max) {
+			why = error::out_of_range;
+			return false;
+		}
+	} break;
+	case validator::check::length: {
+		if ((int64_t)value.size() < v.min) {
+			why = error::too_short;
+			return false;
+		}
+		if ((uint64_t)value.size() > (uint64_t)v.max) {
+			why = error::too_long;
+			return false;
+		}
+	} break;
+	case validator::check::charset: {
+		for (char c : value) {
+			const unsigned char u = (unsigned char)c;
+			if ((v.chars[u / 64] & (uint64_t(1) << (u % 64))) == 0) {
+				why = error::invalid_char;
+				return false;
+			}
+		}
+	} break;
+	case validator::check::path_exists: {
+		/* stat needs a terminated copy, values may be defaults. */
+		char path[4096];
+		struct stat info;
+		if (value.size() >= sizeof(path)) {
+			why = error::no_such_path;
+			return false;
+		}
+		memcpy(path, value.data(), value.size());
+		path[value.size()] = '\0';
+		if (stat(path, &info) != 0) {
+			why = error::no_such_path;
+			return false;
+		}
+	} break;
+	case validator::check::one_of: {
+		if (std::find(v.names, v.names + v.names_size, value)
+				== v.names + v.names_size) {
+			why = error::invalid_choice;
+			return false;
+		}
+	} break;
+	}
+	return true;
+}
+
+NS_GETOPT_INLINE void report_value_error(const argument& arg,
+		const parse_error& err, const options& option) {
+	if (option.error_func)
+		option.error_func(err);
+
+	const stack_string name = make_stack_string(
+			is_positional(arg) ? "'" : "'--", arg.long_arg, "'");
+	const validator* v = err.failed;
+	char min[24] = {};
+	char max[24] = {};
+	if (v != nullptr) {
+		snprintf(min, sizeof(min), "%lld", (long long)v->min);
+		snprintf(max, sizeof(max), "%lld", (long long)v->max);
+	}
+
+	switch (err.kind) {
+	case error::invalid_choice: {
+		stack_string msg = make_stack_string(
+				"'", err.value, "' isn't a valid choice for ", name, " :");
+		const size_t size = v ? v->names_size : arg.choice.size;
+		for (size_t i = 0; i < size; ++i) {
+			msg += (i == 0 ? " " : ", ");
+			msg += v ? v->names[i] : arg.choice.names[i];
+		}
+		maybe_print_msg(option, msg);
+	} break;
+	case error::not_a_number: {
+		maybe_print_msg(option,
+				make_stack_string("'", err.value, "' isn't a number, ", name,
+						" needs one."));
+	} break;
+	case error::out_of_range: {
+		maybe_print_msg(option,
+				make_stack_string("'", err.value, "' is out of range for ",
+						name, " : ", min, " to ", max, "."));
+	} break;
+	case error::too_short: {
+		maybe_print_msg(option,
+				make_stack_string("'", err.value, "' is too short for ", name,
+						" : at least ", min, " characters."));
+	} break;
+	case error::too_long: {
+		maybe_print_msg(option,
+				make_stack_string("'", err.value, "' is too long for ", name,
+						" : at most ", max, " characters."));
+	} break;
+	case error::invalid_char: {
+		maybe_print_msg(option,
+				make_stack_string("'", err.value,
+						"' has invalid characters for ", name, "."));
+	} break;
+	case error::no_such_path: {
+		maybe_print_msg(option,
+				make_stack_string(
+						"'", err.value, "' doesn't exist, for ", name, "."));
+	} break;
+	}
+}
+
+NS_GETOPT_INLINE void print_choices(
+		const choice_view& choice, size_t indentation, bool indent) {
+	if (choice.size == 0)
+		return;
+
+	if (indent)
+		printf("%*s", (int)indentation, "");
+	printf("Choices :");
+	for (size_t i = 0; i < choice.size; ++i) {
+		printf("%s%.*s", i == 0 ? " " : ", ", (int)choice.names[i].size(),
+				choice.names[i].data());
+	}
+	printf("\n");
+}
+
+NS_GETOPT_INLINE void print_aliases(
+		const argument& arg, size_t indentation, bool indent) {
+	bool first = true;
+	for (size_t i = 0; i < arg.aliases_size; ++i) {
+		const alias& al = arg.aliases[i];
+		if (!al.deprecated.empty())
+			continue;
+
+		if (first && indent)
+			printf("%*s", (int)indentation, "");
+		printf(first ? "Aliases :" : ",");
+		if (!al.long_arg.empty())
+			printf(" --%.*s", (int)al.long_arg.size(), al.long_arg.data());
+		if (!al.long_arg.empty() && al.short_arg != '\0')
+			printf(",");
+		if (al.short_arg != '\0')
+			printf(" -%c", al.short_arg);
+		first = false;
+	}
+	if (!first)
+		printf("\n");
+}
+
+NS_GETOPT_INLINE std::string_view slot_name(
+		const lookup_slot& slot, const argument* args) {
+	const argument& a = args[slot.arg_index];
+	return slot.alias == -1 ? a.long_arg : a.aliases[slot.alias].long_arg;
+}
+
+NS_GETOPT_INLINE void print_deprecation(
+		const argument& arg, std::string_view token, const options& option) {
+	const bool is_short = token.size() == 2 && token[1] != '-';
+	for (size_t i = 0; i < arg.aliases_size; ++i) {
+		const alias& al = arg.aliases[i];
+		const bool spelled = is_short
+				? al.short_arg == token[1]
+				: !al.long_arg.empty()
+						&& compare_no_case(token.substr(2), al.long_arg);
+		if (!spelled)
+			continue;
+
+		if (!al.deprecated.empty())
+			maybe_print_msg(option,
+					make_stack_string(
+							"'", token, "' is deprecated. ", al.deprecated));
+		return;
+	}
+}
+
+NS_GETOPT_INLINE bool check_constraints(const argument* args,
+		const constraint_view& rules, const uint64_t* present,
+		const options& option) {
+	auto name = [&](size_t i) {
+		return make_stack_string(is_positional(args[i]) ? "'" : "'--",
+				args[i].long_arg, "'");
+	};
+
+	for (size_t w = 0; w < rules.words; ++w) {
+		const uint64_t missing = rules.required[w] & ~present[w];
+		if (missing != 0) {
+			const size_t x = w * 64 + lowest_bit(missing);
+			maybe_print_msg(
+					option, make_stack_string(name(x), " is required."));
+			return false;
+		}
+	}
+
+	for (size_t e = 0; e < rules.entries_size; ++e) {
+		const size_t a = rules.entries[e].arg;
+		if ((present[a / 64] & (uint64_t(1) << (a % 64))) == 0)
+			continue;
+
+		const bool conflicts = rules.entries[e].kind == rule::conflicts;
+		const uint64_t* mask = rules.masks + e * rules.words;
+		for (size_t w = 0; w < rules.words; ++w) {
+			const uint64_t hit
+					= mask[w] & (conflicts ? present[w] : ~present[w]);
+			if (hit != 0) {
+				maybe_print_msg(option,
+						make_stack_string(name(a),
+								conflicts ? " conflicts with " : " requires ",
+								name(w * 64 + lowest_bit(hit)), "."));
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+NS_GETOPT_INLINE bool check_command(
+		const command_argv& command, const options& option) {
+	if (command.error == command_error::none)
+		return true;
+
+	maybe_print_msg(option,
+			command.error == command_error::unterminated_quote
+					? "Unterminated quote in command."
+					: "Trailing backslash in command.");
+	if (has_flag(option.flags, flag::exit_on_error))
+		exit(option.exit_code);
+	return false;
+}
+
+NS_GETOPT_INLINE bool print_version(
+		std::string_view version, const options& option) {
+	printf("%.*s\n", (int)version.size(), version.data());
+
+	if (has_flag(option.flags, flag::exit_on_error))
+		exit(0);
+	return false;
+}
+
+NS_GETOPT_INLINE bool char_compare_no_case(
+		unsigned char lhs, unsigned char rhs) {
+	return to_lower(lhs) == to_lower(rhs);
+}
+
+NS_GETOPT_INLINE bool compare_no_case(const char* lhs, std::string_view rhs,
+		const size_t lhs_start_pos, const size_t rhs_start_pos) {
+	return compare_no_case(
+			std::string_view(lhs), rhs, lhs_start_pos, rhs_start_pos);
+}
+
+NS_GETOPT_INLINE bool compare_no_case(std::string_view lhs,
+		std::string_view rhs, const size_t lhs_start_pos,
+		const size_t rhs_start_pos) {
+	if (lhs_start_pos >= lhs.size())
+		return false;
+
+	if (rhs_start_pos >= rhs.size())
+		return false;
+
+	/* Sizes first, so long garbage tokens are rejected in O(1). */
+	if (lhs.size() - lhs_start_pos != rhs.size() - rhs_start_pos)
+		return false;
+
+	return std::equal(lhs.begin() + lhs_start_pos, lhs.end(),
+			rhs.begin() + rhs_start_pos, char_compare_no_case);
+}
+
+NS_GETOPT_INLINE void maybe_print_msg(const options& option, stack_string msg) {
+	maybe_print_msg(option, msg.c_str());
+}
+
+NS_GETOPT_INLINE void maybe_print_msg(
+		const options& option, std::string_view msg) {
+	if (has_flag(option.flags, flag::no_user_error_messages))
+		return;
+	printf("%.*s\n", (int)msg.size(), msg.data());
+}
+} // namespace detail
+} // namespace opt
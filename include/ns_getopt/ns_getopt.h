@@ -32,13 +32,28 @@
  **/
 
 #pragma once
+#include <algorithm>
 #include <array>
 #include <cassert>
-#include <cctype> // std::tolower
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <functional>
+#include <memory_resource>
 #include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Define NS_GETOPT_COMPILED and link ns_getopt::compiled to build the
+ * non-template core once, rather than in every translation unit.
+ **/
+#if defined(NS_GETOPT_COMPILED)
+#define NS_GETOPT_INLINE
+#else
+#define NS_GETOPT_INLINE inline
+#endif
 
 namespace opt {
 /* Default multi argument array. */
@@ -46,6 +61,26 @@ constexpr size_t multi_array_max_size = 8;
 using multi_array
 		= std::array<std::string_view, multi_array_max_size>; // TODO: Size
 															  // build option.
+/* Zero-copy view of consecutive argv entries. A span running to the end of
+ * main's argv is followed by its null entry, so data can go to execv. */
+struct argv_span {
+	char const* const* data = nullptr;
+	size_t size = 0;
+
+	std::string_view operator[](size_t i) const {
+		return data[i];
+	}
+	char const* const* begin() const {
+		return data;
+	}
+	char const* const* end() const {
+		return data + size;
+	}
+	bool empty() const {
+		return size == 0;
+	}
+};
+
 /* Used for stack strings (char s[N]). */
 constexpr size_t stack_string_size = 128;
 
@@ -56,7 +91,143 @@ enum class type : std::uint8_t {
 	optional_arg,
 	default_arg,
 	multi_arg,
-	raw_arg
+	raw_arg,
+	variadic_arg, // Trailing positional, takes the rest of the command line.
+	count_arg, // Repeatable, counts its occurrences.
+	list_arg // Repeatable, collects one value per occurrence.
+};
+
+namespace detail {
+/* Size erased choices. */
+struct choice_view {
+	const std::string_view* names = nullptr; // Declared order.
+	const int16_t* slots = nullptr; // Index in names, -1 if empty.
+	uint32_t multiplier = 0;
+	uint32_t shift = 0;
+	size_t size = 0;
+
+	/* Index of the choice matching s, -1 if none. */
+	NS_GETOPT_INLINE int find(std::string_view s) const;
+};
+
+/* Power of 2, at most a quarter full. */
+constexpr size_t choice_slots_size(size_t choices_size) {
+	size_t ret = 1;
+	while (ret < choices_size * 4) {
+		ret <<= 1;
+	}
+	return ret;
+}
+
+/**
+ * Rejects invalid choices or impossible constraints, in every build. Not
+ * constexpr, so constant evaluation stops here and shows why. At runtime,
+ * prints why and aborts.
+ **/
+[[noreturn]] inline void table_error(const char* why) {
+	fprintf(stderr, "ns_getopt : %s\n", why);
+	std::abort();
+}
+} // namespace detail
+
+/* A name and the value it maps to. */
+template <class Enum>
+struct choice {
+	std::string_view name;
+	Enum value;
+};
+
+/**
+ * Fixed set of values accepted by an argument, matched case insensitively
+ * like long arguments. A perfect hash is searched at construction, declare
+ * them constexpr to do it at compile time : a lookup then hashes the value
+ * once, reads one slot and compares one name.
+ **/
+template <class Enum, size_t choices_size>
+struct choices {
+	static_assert(choices_size > 0 && choices_size <= INT16_MAX,
+			"Choices must fit an int16_t index.");
+	static constexpr size_t slots_size
+			= detail::choice_slots_size(choices_size);
+	using callback = std::function<bool(Enum)>;
+
+	constexpr explicit choices(const choice<Enum> (&list)[choices_size]);
+
+	/* Value named s, nullptr if none. */
+	constexpr const Enum* find(std::string_view s) const;
+	detail::choice_view view() const;
+
+	std::array<std::string_view, choices_size> names{};
+	std::array<Enum, choices_size> values{};
+	std::array<int16_t, slots_size> slots{};
+	uint32_t multiplier = 0;
+	uint32_t shift = 0;
+};
+
+/* make_choices<mode>({ { "fast", mode::fast }, { "exact", mode::exact } }) */
+template <class Enum, size_t choices_size>
+constexpr choices<Enum, choices_size> make_choices(
+		const choice<Enum> (&list)[choices_size]);
+
+/* ASCII character classes, for charset. */
+enum char_class : std::uint8_t {
+	lower = 1,
+	upper = 2,
+	alpha = lower | upper,
+	digit = 4,
+	alnum = alpha | digit,
+	xdigit = 8,
+	space = 16,
+	punct = 32
+};
+
+/**
+ * A check of argument values, run before the callback. Plain data, built
+ * by in_range, min_len, max_len, charset, path_exists and one_of. Checking
+ * allocates nothing.
+ **/
+struct validator {
+	enum class check : std::uint8_t {
+		in_range, // Base 10 integer in [min, max].
+		length, // Size in [min, max].
+		charset, // Only characters in chars.
+		path_exists,
+		one_of // One of names, case sensitive.
+	};
+
+	check kind;
+	int64_t min = 0;
+	int64_t max = 0;
+	std::array<uint64_t, 4> chars{}; // 256 bits.
+	const std::string_view* names = nullptr;
+	size_t names_size = 0;
+};
+
+constexpr validator in_range(int64_t min, int64_t max);
+constexpr validator min_len(size_t len);
+constexpr validator max_len(size_t len);
+
+/* charset(alnum, '-', '_'), char_class or char arguments. */
+template <class... Chars>
+constexpr validator charset(Chars... chars);
+
+constexpr validator path_exists();
+
+/* names must outlive the validator. */
+template <size_t names_size>
+constexpr validator one_of(const std::string_view (&names)[names_size]);
+
+/**
+ * Another spelling of an argument, see argument::known_as. It resolves to
+ * the same argument through the lookup index, so passing both spellings
+ * is a repeat. Only long_arg is abbreviated and suggested.
+ **/
+struct alias {
+	std::string_view long_arg; // Empty if short only.
+	char short_arg = '\0';
+	/* Printed when used, empty if the spelling is current. Deprecated
+	 * spellings are left out of the help. */
+	std::string_view deprecated = "";
 };
 
 /* User argument. */
@@ -64,30 +235,85 @@ struct argument {
 	const std::function<bool()> no_arg_func;
 	const std::function<bool(std::string_view)> one_arg_func;
 	const std::function<bool(const multi_array&, size_t)> multi_arg_func;
+	const std::function<bool(argv_span)> span_arg_func;
+	const std::function<bool(size_t)> count_arg_func;
 	const std::string_view long_arg;
 	const std::string_view description;
 	const std::string_view default_arg;
+	const detail::choice_view choice{}; // Accepted values, empty if any.
 	const size_t multi_max_len;
 	int raw_arg_pos;
 	const char short_arg;
 	const type arg_type;
 	bool parsed;
 
-	inline argument(std::string_view long_arg, type arg_type,
+	/* Used with flag::deferred_callbacks. Callbacks run in ascending phase
+	 * order. Independent callbacks of a phase run concurrently. */
+	unsigned char phase = 0;
+	bool independent = false;
+
+	/* Checked in order on every value, see validate. */
+	const validator* validators = nullptr;
+	size_t validators_size = 0;
+
+	/* Other spellings, see known_as. */
+	const alias* aliases = nullptr;
+	size_t aliases_size = 0;
+
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
 			const std::function<bool()>& no_arg_func,
 			std::string_view description = "", char short_arg = '\0');
 
-	inline argument(std::string_view long_arg, type arg_type,
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
 			const std::function<bool(std::string_view)>& one_arg_func,
 			std::string_view description = "", char short_arg = '\0',
 			std::string_view default_arg = "");
 
-	inline argument(std::string_view long_arg, type arg_type,
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
 			const std::function<bool(const multi_array&, size_t)>&,
 			std::string_view description = "", char short_arg = '\0',
 			size_t multi_max_subargs = multi_array_max_size);
 
-	inline void asserts();
+	/* variadic_arg and list_arg, called once with every value. */
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
+			const std::function<bool(argv_span)>& span_arg_func,
+			std::string_view description = "", char short_arg = '\0');
+
+	/* count_arg, called once with the number of occurrences. */
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
+			const std::function<bool(size_t)>& count_arg_func,
+			std::string_view description = "", char short_arg = '\0');
+
+	/* Without callback, for parse_results. */
+	NS_GETOPT_INLINE argument(std::string_view long_arg, type arg_type,
+			std::string_view description = "", char short_arg = '\0',
+			std::string_view default_arg = "");
+
+	/* required_arg, default_arg or raw_arg restricted to allowed, called
+	 * with the matching value. allowed must outlive the argument. */
+	template <class Enum, size_t choices_size>
+	argument(std::string_view long_arg, type arg_type,
+			const choices<Enum, choices_size>& allowed,
+			const typename choices<Enum, choices_size>::callback& func,
+			std::string_view description = "", char short_arg = '\0',
+			std::string_view default_arg = "");
+
+	/* Without callback, for parse_results. */
+	template <class Enum, size_t choices_size>
+	argument(std::string_view long_arg, type arg_type,
+			const choices<Enum, choices_size>& allowed,
+			std::string_view description = "", char short_arg = '\0',
+			std::string_view default_arg = "");
+
+	/* list must outlive the argument. */
+	template <size_t list_size>
+	argument& validate(const validator (&list)[list_size]);
+
+	/* list must outlive the argument. Positional arguments have none. */
+	template <size_t list_size>
+	argument& known_as(const alias (&list)[list_size]);
+
+	NS_GETOPT_INLINE void asserts();
 };
 
 enum flag : unsigned int {
@@ -96,30 +322,360 @@ enum flag : unsigned int {
 	exit_on_error = 2,
 	arguments_are_optional = 4,
 	arg0_is_normal_argument = 8,
-	dont_print_help = 16
+	dont_print_help = 16,
+	deferred_callbacks = 32,
+	allow_abbreviations = 64,
+	enable_completion = 128
 };
 
+/* Shells supported by print_completion. */
+enum class shell : std::uint8_t { bash, zsh, fish };
+
+/* Arguments recognized by prescan, without an argument table. */
+enum class early_exit : std::uint8_t { none, help, version, completion };
+
 inline flag operator|(flag lhs, flag rhs);
 inline flag& operator|=(flag& lhs, flag rhs);
 
+/* Kinds of rejected values. */
+enum class error : std::uint8_t {
+	invalid_choice, // Not one of the argument's choices, or of one_of.
+	not_a_number,
+	out_of_range,
+	too_short,
+	too_long,
+	invalid_char,
+	no_such_path
+};
+
+/* A rejected value, handed to options::error_func. */
+struct parse_error {
+	error kind;
+	int arg_index; // In the argument table.
+	int argv_index; // Of the value.
+	std::string_view value;
+	const validator* failed = nullptr; // Null for choices.
+};
+
 /* Configuration options. */
 struct options {
 	const std::function<bool(std::string_view)> first_argument_func;
+	/* Called with rejected values, messages or not. */
+	const std::function<void(const parse_error&)> error_func;
+	/* Every allocation of a parse comes from here. */
+	std::pmr::memory_resource* const resource;
 	const std::string_view help_intro;
 	const std::string_view help_outro;
 	const int exit_code;
 	const flag flags;
 
-	inline options(
+	NS_GETOPT_INLINE options(
 			std::string_view help_intro = "", std::string_view help_outro = "",
 			flag flags = flag::none,
 			const std::function<bool(std::string_view)>& first_argument_func
 			= [](std::string_view) { return true; },
-			int exit_code = -1);
+			int exit_code = -1,
+			const std::function<void(const parse_error&)>& error_func
+			= nullptr,
+			std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource());
 
 	// inline ~options(){}; // Fix clang < 4.0
 };
 
+/* Kinds of constraint between arguments. */
+enum class rule : std::uint8_t {
+	required, // arg must be given.
+	conflicts, // arg and other can't both be given.
+	depends // arg needs other.
+};
+
+/* A constraint, arguments are indices in the argument table. */
+struct constraint {
+	rule kind;
+	size_t arg;
+	size_t other;
+};
+
+constexpr constraint require(size_t arg) {
+	return { rule::required, arg, 0 };
+}
+constexpr constraint conflict(size_t arg, size_t other) {
+	return { rule::conflicts, arg, other };
+}
+constexpr constraint depend(size_t arg, size_t other) {
+	return { rule::depends, arg, other };
+}
+
+namespace detail {
+/* The conflicts or depends rules of one argument, merged in a mask. */
+struct constraint_entry {
+	int16_t arg;
+	rule kind;
+};
+
+/* Size erased constraints. */
+struct constraint_view {
+	const uint64_t* required;
+	const constraint_entry* entries;
+	const uint64_t* masks; // words per entry.
+	size_t entries_size;
+	size_t words;
+};
+
+constexpr size_t lowest_bit(uint64_t x) {
+	size_t ret = 0;
+	while ((x & 1) == 0) {
+		x >>= 1;
+		++ret;
+	}
+	return ret;
+}
+} // namespace detail
+
+/**
+ * Constraints of an argument table, checked once parsing is done. Presence
+ * is tracked in a bitset, so checking costs a word operation per 64
+ * arguments for required ones, plus one per rule of the given arguments.
+ *
+ * Declare them constexpr to reject impossible sets at compile time : out
+ * of range or self referencing rules, and arguments which, with everything
+ * they depend on, conflict with themselves. The required arguments are
+ * checked that way too.
+ **/
+template <size_t args_size, size_t rules_size>
+struct constraints {
+	static constexpr size_t words = (args_size + 63) / 64;
+
+	constexpr explicit constraints(const constraint (&rules)[rules_size]);
+
+	detail::constraint_view view() const;
+
+	std::array<uint64_t, words> required{};
+	std::array<detail::constraint_entry, rules_size> entries{};
+	std::array<uint64_t, words * rules_size> masks{};
+	size_t entries_size = 0;
+
+private:
+	using bitset = std::array<uint64_t, words>;
+	constexpr bitset closure(bitset set) const;
+	constexpr bool self_conflicting(const bitset& set) const;
+};
+
+/* make_constraints<args_size>({ require(0), conflict(1, 2) }) */
+template <size_t args_size, size_t rules_size>
+constexpr constraints<args_size, rules_size> make_constraints(
+		const constraint (&rules)[rules_size]);
+
+/* A lookup index slot, hashed long name to argument. */
+struct lookup_slot {
+	uint32_t hash;
+	int16_t arg_index; // -1 if empty.
+	int16_t alias; // In the argument's aliases, -1 for its long_arg.
+};
+
+namespace detail {
+/**
+ * Hot half of an argument table, the argument array being the cold half.
+ * Lookup keys are packed in small arrays, so a lookup touches one slot line
+ * and the matching argument to confirm.
+ **/
+struct lookup_table {
+	lookup_slot* slots;
+	size_t slots_mask;
+	int16_t* short_args; // Indexed by char.
+	type* types;
+	int16_t* positionals; // Raw args, in declared order.
+	int16_t positionals_size;
+	int16_t variadic_arg; // -1 if none.
+	const constraint_view* constraints = nullptr;
+	uint64_t* present = nullptr; // Bitset, with constraints.
+	/* Arguments whose aliases didn't all fit the slots, scanned on a
+	 * miss. Empty unless aliases outnumber arguments. */
+	int16_t overflow_begin = 0;
+	int16_t overflow_end = 0;
+
+	NS_GETOPT_INLINE void build(const argument* args, size_t args_size);
+	NS_GETOPT_INLINE int find_long(
+			std::string_view name, const argument* args) const;
+	NS_GETOPT_INLINE int find_short(char c) const;
+};
+
+/* Power of 2, at most half full. */
+constexpr size_t lookup_slots_size(size_t args_size) {
+	size_t ret = 1;
+	while (ret < args_size * 2) {
+		ret <<= 1;
+	}
+	return ret;
+}
+} // namespace detail
+
+/**
+ * Lookup index of an argument table. parse_arguments builds one per call,
+ * keep one around to skip that when parsing many times.
+ **/
+template <size_t args_size>
+struct compiled_table {
+	static_assert(args_size <= INT16_MAX, "Too many arguments.");
+
+	compiled_table() = default;
+	explicit compiled_table(const std::array<argument, args_size>& args);
+	explicit compiled_table(const argument (&args)[args_size]);
+	explicit compiled_table(const argument* args);
+
+	/* rules must outlive the table. */
+	template <size_t rules_size>
+	compiled_table(const std::array<argument, args_size>& args,
+			const constraints<args_size, rules_size>& rules);
+	template <size_t rules_size>
+	compiled_table(const argument* args,
+			const constraints<args_size, rules_size>& rules);
+
+	void build(const argument* args);
+	template <size_t rules_size>
+	void constrain(const constraints<args_size, rules_size>& rules);
+	detail::lookup_table table();
+
+private:
+	std::array<lookup_slot, detail::lookup_slots_size(args_size)>
+			_slots;
+	std::array<int16_t, 256> _short_args;
+	std::array<type, args_size> _types;
+	std::array<int16_t, args_size> _positionals;
+	int16_t _positionals_size = 0;
+	int16_t _variadic_arg = -1;
+	detail::constraint_view _constraints{};
+	std::array<uint64_t, (args_size + 63) / 64> _present;
+	int16_t _overflow_begin = 0;
+	int16_t _overflow_end = 0;
+};
+
+/**
+ * Lookup index built ahead of time as constant data, what ns_getopt_gen
+ * emits. Parsing against it builds nothing. Same layout as a
+ * compiled_table's, without constraints, every alias fitting the slots.
+ **/
+struct prebuilt_table {
+	const lookup_slot* slots;
+	size_t slots_mask;
+	const int16_t* short_args; // Indexed by char.
+	const type* types;
+	const int16_t* positionals; // Raw args, in declared order.
+	int16_t positionals_size;
+	int16_t variadic_arg; // -1 if none.
+
+	NS_GETOPT_INLINE detail::lookup_table table() const;
+};
+
+/* One argument of a parse_result. */
+struct parsed_arg {
+	int argv_index = -1; // -1 if absent. First occurrence if repeatable.
+	int values_index = -1; // First value in argv, -1 if none.
+	int values_count = 0;
+	std::string_view value; // Single value, may point to default_arg.
+	char const* const* values = nullptr; // In argv, or collected list_arg.
+	int count = 0; // Occurrences.
+};
+
+/**
+ * What parse_results found, without running any callback. Views a caller
+ * provided buffer of one parsed_arg per argument, indexed like the argument
+ * table. Values point into argv, keep it around. list_arg values are
+ * collected in list_values, the only allocation, from resource.
+ **/
+struct parse_result {
+	inline parse_result(parsed_arg* buffer, size_t buffer_size,
+			std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource());
+
+	inline bool has(size_t id) const;
+	inline std::string_view get(size_t id) const; // Last value if repeated.
+	inline argv_span values(size_t id) const;
+	inline int position(size_t id) const; // Index in argv, -1 if absent.
+	inline size_t count(size_t id) const;
+
+	inline void clear();
+
+	parsed_arg* data;
+	size_t size;
+	char const* const* argv = nullptr;
+	std::pmr::vector<char const*> list_values;
+};
+
+namespace detail {
+/* Null terminated pointer array, on the stack up to small_size, then
+ * from resource. */
+struct argv_storage {
+	static constexpr size_t small_size = 64;
+
+	explicit argv_storage(std::pmr::memory_resource* resource)
+			: _large(resource) {
+	}
+	argv_storage(const argv_storage&) = delete;
+	argv_storage& operator=(const argv_storage&) = delete;
+
+	NS_GETOPT_INLINE void push(char const* token);
+	NS_GETOPT_INLINE void clear();
+	/* Terminates, returns argv. */
+	NS_GETOPT_INLINE char const* const* finish(int& argc);
+
+private:
+	std::array<char const*, small_size> _small;
+	std::pmr::vector<char const*> _large;
+	size_t _size = 0;
+};
+} // namespace detail
+
+/**
+ * argv of one NUL separated buffer, /proc/<pid>/cmdline for example. The
+ * strings aren't copied, only a pointer per token is gathered, on the
+ * stack up to 64. A last token left unterminated by a truncated read is
+ * copied. argv[argc] is null, keep the buffer around.
+ **/
+struct buffer_argv {
+	NS_GETOPT_INLINE explicit buffer_argv(std::string_view buffer,
+			std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource());
+
+	int argc = 0;
+	char const* const* argv = nullptr;
+
+private:
+	detail::argv_storage _storage;
+	std::pmr::vector<char> _tail;
+};
+
+/* Why a command string couldn't be split. */
+enum class command_error : std::uint8_t {
+	none,
+	unterminated_quote,
+	trailing_backslash
+};
+
+/**
+ * argv of a command string, split like a POSIX shell would without
+ * expanding anything. Blanks separate arguments, a backslash escapes the
+ * next character, single quotes keep everything and double quotes keep
+ * everything but \\, \", \$, \` and line continuations.
+ *
+ * Split in place : every argument is NUL terminated in command, which must
+ * be. Text only moves once a quote or backslash has been removed from an
+ * argument. argv[argc] is null, keep command around.
+ **/
+struct command_argv {
+	NS_GETOPT_INLINE explicit command_argv(char* command,
+			std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource());
+
+	int argc = 0;
+	char const* const* argv = nullptr;
+	command_error error = command_error::none; // Arguments are dropped.
+
+private:
+	detail::argv_storage _storage;
+};
+
 template <size_t args_size>
 inline void print_help(const std::array<argument, args_size>& args,
 		const char* arg0, const options& option);
@@ -128,8 +684,29 @@ template <size_t args_size>
 inline void print_help(const argument (&args)[args_size], const char* arg0,
 		const options& option);
 
-inline void print_help(const argument* args, size_t args_size, const char* arg0,
-		const options& option);
+NS_GETOPT_INLINE void print_help(const argument* args, size_t args_size,
+		const char* arg0, const options& option);
+
+/* Prints a completion script for arg0, generated from args. */
+template <size_t args_size>
+inline void print_completion(const std::array<argument, args_size>& args,
+		const char* arg0, shell sh);
+
+template <size_t args_size>
+inline void print_completion(
+		const argument (&args)[args_size], const char* arg0, shell sh);
+
+NS_GETOPT_INLINE void print_completion(
+		const argument* args, size_t args_size, const char* arg0, shell sh);
+
+/**
+ * Completion candidates for the last of words, a partial command line
+ * without arg0. Calls func(dashes, name) per candidate, runs no callbacks.
+ * With flag::enable_completion, "arg0 __complete <words>" prints them.
+ **/
+template <class Func>
+inline void complete(const argument* args, size_t args_size, int words_size,
+		char const* const* words, Func&& func);
 
 template <size_t args_size>
 inline bool parse_arguments(int argc, char const* const* argv,
@@ -143,6 +720,129 @@ template <size_t args_size>
 inline bool parse_arguments(int argc, char const* const* argv, argument* args,
 		const options& option = {});
 
+/* Uses a prebuilt lookup index. */
+template <size_t args_size>
+inline bool parse_arguments(int argc, char const* const* argv,
+		std::array<argument, args_size>& args,
+		compiled_table<args_size>& table, const options& option = {});
+
+template <size_t args_size>
+inline bool parse_arguments(int argc, char const* const* argv, argument* args,
+		compiled_table<args_size>& table, const options& option = {});
+
+/* Parses a sub-range of argv, a subcommand's arguments for example. */
+template <size_t args_size>
+inline bool parse_arguments(argv_span argv,
+		std::array<argument, args_size>& args, const options& option = {});
+
+template <size_t args_size>
+inline bool parse_arguments(argv_span argv, argument (&args)[args_size],
+		const options& option = {});
+
+/* Parses a command string, arg0 included, through a command_argv. command
+ * is split in place. */
+template <size_t args_size>
+inline bool parse_command(char* command,
+		std::array<argument, args_size>& args, const options& option = {});
+
+template <size_t args_size>
+inline bool parse_command(char* command, argument (&args)[args_size],
+		const options& option = {});
+
+template <size_t args_size>
+inline bool parse_command(char* command, argument* args,
+		compiled_table<args_size>& table, const options& option = {});
+
+/* Parses a NUL separated buffer, arg0 included, through a buffer_argv. */
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer,
+		std::array<argument, args_size>& args, const options& option = {});
+
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer,
+		argument (&args)[args_size], const options& option = {});
+
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer, argument* args,
+		compiled_table<args_size>& table, const options& option = {});
+
+/**
+ * Looks at the first argument only, no argument table needed. -h, --help
+ * and /? are help, --version is version, __complete is completion with
+ * flag::enable_completion. Allocates nothing.
+ **/
+NS_GETOPT_INLINE early_exit prescan(
+		int argc, char const* const* argv, const options& option = {});
+
+/**
+ * parse_arguments, with the argument table returned by make_args() only
+ * built when argv needs it. A leading --version prints version and returns
+ * false without calling make_args, exiting with 0 on flag::exit_on_error.
+ * Help and completion need the table.
+ **/
+template <class Factory>
+inline bool parse_arguments_lazy(int argc, char const* const* argv,
+		Factory&& make_args, std::string_view version,
+		const options& option = {});
+
+/**
+ * Parses into result instead of calling callbacks. result needs room for
+ * args_size entries. Allocates nothing, unless printing an error or
+ * collecting list_arg values. Resets argument::parsed first, so a table can
+ * be reused for many command lines.
+ **/
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, parse_result& result,
+		const options& option = {});
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv,
+		argument (&args)[args_size], parse_result& result,
+		const options& option = {});
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		parse_result& result, const options& option = {});
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		compiled_table<args_size>& table, parse_result& result,
+		const options& option = {});
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		const prebuilt_table& table, parse_result& result,
+		const options& option = {});
+
+/**
+ * Canonical form of a command line, so equivalent ones compare equal.
+ * Options come in table order under their declared name, followed by their
+ * values, with default_arg expanded and choices spelled as declared.
+ * Repeatable options are repeated, with values in argv order. Raw args
+ * follow, in declared order.
+ * Calls func(dashes, text) per token, arg0 excluded, dashes being "--",
+ * "-" (short only options) or "" (values). Runs no callbacks.
+ **/
+template <size_t args_size, class Func>
+inline bool canonicalize(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, Func&& func,
+		const options& option = {});
+
+template <size_t args_size, class Func>
+inline bool canonicalize(int argc, char const* const* argv, argument* args,
+		Func&& func, const options& option = {});
+
+/* 64-bit hash of the canonical form. Only list_arg values allocate. */
+template <size_t args_size>
+inline bool canonical_hash(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, uint64_t& hash,
+		const options& option = {});
+
+template <size_t args_size>
+inline bool canonical_hash(int argc, char const* const* argv, argument* args,
+		uint64_t& hash, const options& option = {});
+
 namespace detail {
 
 template <size_t N = 128>
@@ -175,91 +875,453 @@ stack_string make_stack_string(Args&&... args) {
 	return ((ret += args), ...);
 }
 
-inline void print_description(std::string_view s, size_t indentation);
+/**
+ * Compact trie over the case folded long arguments. Nodes are stored
+ * contiguously, siblings are sorted by character.
+ **/
+struct trie {
+	static constexpr int not_found = -1;
+	static constexpr int ambiguous = -2;
+	static constexpr size_t max_candidates = 4;
+	static constexpr size_t max_distance = 2;
+
+	struct node {
+		int first_child = -1;
+		int next_sibling = -1;
+		int arg_index = not_found; // A long_arg ends here.
+		int unique_arg = not_found; // Only argument below, or ambiguous.
+		unsigned char ch = 0;
+	};
+
+	explicit trie(std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource())
+			: nodes(resource) {
+	}
+
+	/* Only indexes long arguments starting with prefix. */
+	NS_GETOPT_INLINE void build(const argument* args, size_t args_size,
+			std::string_view prefix = {});
+
+	/* Exact or unique prefix match. O(s.size()). */
+	NS_GETOPT_INLINE int match_prefix(std::string_view s) const;
+
+	/* Arguments starting with s, in lexicographic order. */
+	NS_GETOPT_INLINE size_t prefix_candidates(
+			std::string_view s, int* out, size_t out_size) const;
+
+	/* Calls func(arg_index) for every argument starting with s, in
+	 * lexicographic order. Stops early if func returns false. */
+	template <class Func>
+	void for_each_prefixed(std::string_view s, Func&& func) const;
+
+	/* Closest arguments within max_dist edits, closest first. */
+	NS_GETOPT_INLINE size_t suggest(std::string_view s, size_t max_dist,
+			int* out, size_t out_size) const;
+
+	std::pmr::vector<node> nodes;
+	size_t max_depth = 0;
+
+private:
+	NS_GETOPT_INLINE int find_child(int n, unsigned char c) const;
+	NS_GETOPT_INLINE int insert_child(int n, unsigned char c);
+	NS_GETOPT_INLINE int find_node(std::string_view s) const;
+	template <class Func>
+	bool for_each_below(int n, Func& func) const;
+	NS_GETOPT_INLINE void suggest(int n, size_t depth, std::string_view s,
+			size_t max_dist, std::pmr::vector<size_t>& rows, int* out,
+			size_t* out_dist, size_t out_size, size_t& count) const;
+};
+
+/* A matched argument, ready for its callback. */
+struct parse_event {
+	int arg_index;
+	int argv_index;
+	int values_index; // First value in argv, -1 if none.
+	int values_count;
+	std::string_view value; // Single value, may point to default_arg.
+	char const* const* values = nullptr; // Set from values_index if null.
+	int count = 1; // Occurrences of repeatable arguments.
+};
+
+/* An occurrence of a repeatable argument. */
+struct repeat {
+	int arg_index;
+	int argv_index; // Of the value for list_arg.
+};
+
+/* Receives parse events, returns false if the callback failed. Not a
+ * std::function, we don't want to allocate anything while parsing. */
+struct event_sink {
+	bool (*func)(void*, const parse_event&);
+	void* user;
+
+	bool operator()(const parse_event& ev) const {
+		return func(user, ev);
+	}
+};
+
+template <class T>
+event_sink make_sink(T& t) {
+	return { [](void* user, const parse_event& ev) {
+				return (*static_cast<T*>(user))(ev);
+			},
+		&t };
+}
+
+/* Stores events in a parse_result, indexed by argument. */
+struct result_store {
+	parsed_arg* data;
+
+	NS_GETOPT_INLINE bool operator()(const parse_event& ev);
+};
+
+/* Executes callbacks as soon as their argument is parsed. */
+struct immediate_dispatch {
+	argument* args;
+	char const* const* argv;
+
+	NS_GETOPT_INLINE bool operator()(const parse_event& ev);
+};
+
+/* Records events, for flag::deferred_callbacks. */
+struct event_list {
+	parse_event* data;
+	size_t size;
+
+	NS_GETOPT_INLINE bool operator()(const parse_event& ev);
+};
+
+/**
+ * The parser, as a resumable state machine. next parses argv up to the
+ * next event and stops there. Events are checked and their argument
+ * marked parsed, nothing is called. Repeatable arguments gather every
+ * occurrence, so they come once the last token is read, constraints are
+ * checked after them.
+ **/
+struct token_parser {
+	NS_GETOPT_INLINE token_parser(int argc, char const* const* argv,
+			argument* args, size_t args_size, const lookup_table& table,
+			const options& option,
+			std::pmr::vector<char const*>& list_values);
+
+	/* False once done, or if parsing failed. */
+	NS_GETOPT_INLINE bool next(parse_event& ev);
+
+	/* Ends parsing like the parse functions fail, printing help or
+	 * exiting as options ask. Returns false. */
+	NS_GETOPT_INLINE bool fail();
+
+	const int argc;
+	char const* const* const argv;
+	argument* const args;
+	const size_t args_size;
+	const lookup_table& table;
+	const options& option;
+	std::pmr::vector<char const*>& list_values;
+
+	/* Long argument lookup index, for abbreviations and suggestions. */
+	trie index;
+	bool index_built = false;
+
+	/* Repeatable arguments are collected, and handed over once done. */
+	std::pmr::vector<repeat> repeats;
+	size_t next_repeat = 0;
+
+	int next_token = 0;
+	int parsed_raw_args = 0; // Raw args are parsed in declared order.
+	bool options_ended = false; // After "--", everything is positional.
+	bool tokens_read = false;
+	bool done = false;
+	bool failed = false;
+
+	/* Concatenated short args, one event each. */
+	std::array<int, 256> shorts;
+	size_t shorts_size = 0;
+	size_t shorts_next = 0;
+	int shorts_argv_index = 0;
+};
+
+/* Runs a token_parser to the end, handing events to sink. */
+NS_GETOPT_INLINE bool parse_tokens(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		const options& option, event_sink sink,
+		std::pmr::vector<char const*>& list_values);
+
+/* Size erased parse_arguments, events has room for args_size events. */
+NS_GETOPT_INLINE bool parse_and_dispatch(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		parse_event* events, const options& option);
+
+/* Size erased parse_results. */
+NS_GETOPT_INLINE bool parse_into(int argc, char const* const* argv,
+		argument* args, size_t args_size, const lookup_table& table,
+		parse_result& result, const options& option);
+
+NS_GETOPT_INLINE bool invoke_callback(
+		const argument& arg, const parse_event& ev);
+
+NS_GETOPT_INLINE stack_string callback_error_msg(
+		const argument& arg, const parse_event& ev);
+
+/* Phases in ascending order. Within a phase, argv order. */
+NS_GETOPT_INLINE void sort_by_phase(const argument* args, parse_event* events,
+		size_t events_size, std::pmr::memory_resource* resource);
+
+NS_GETOPT_INLINE bool dispatch_events(const argument* args, size_t args_size,
+		parse_event* events, size_t events_size, char const* const* argv,
+		const options& option);
+
+NS_GETOPT_INLINE void print_description(std::string_view s, size_t indentation);
 
-inline bool do_exit(const argument* args, size_t args_size,
+/* Prints the first line of s for shell scripts, without skip_chars. */
+NS_GETOPT_INLINE void print_script_text(
+		std::string_view s, std::string_view skip_chars);
+
+NS_GETOPT_INLINE std::string_view program_name(const char* arg0);
+
+NS_GETOPT_INLINE bool takes_value(const argument& arg);
+
+/* Raw or variadic arg, matched by position rather than by name. */
+NS_GETOPT_INLINE bool is_positional(const argument& arg);
+
+/* count_arg or list_arg, accepted more than once. */
+NS_GETOPT_INLINE bool is_repeatable(const argument& arg);
+
+NS_GETOPT_INLINE bool do_exit(const argument* args, size_t args_size,
 		const options& option, const char* arg0);
 
-inline bool char_compare_no_case(unsigned char lhs, unsigned char rhs);
+/* Rejects values which aren't one of arg's choices, or fail one of its
+ * validators. Every value of the event is checked. */
+NS_GETOPT_INLINE bool check_value(const argument* args,
+		const parse_event& ev, const options& option);
 
-inline bool compare_no_case(const char* lhs, std::string_view rhs,
-		const size_t lhs_start_pos = 0, const size_t rhs_start_pos = 0);
+/* True if value passes v, else why it doesn't. */
+NS_GETOPT_INLINE bool run_validator(
+		const validator& v, std::string_view value, error& why);
 
-inline bool compare_no_case(std::string_view lhs, std::string_view rhs,
-		const size_t lhs_start_pos = 0, const size_t rhs_start_pos = 0);
+/* Reports a rejected value, to error_func and as a message. */
+NS_GETOPT_INLINE void report_value_error(const argument& arg,
+		const parse_error& err, const options& option);
 
-inline void maybe_print_msg(const options& option, stack_string msg);
-inline void maybe_print_msg(const options& option, std::string_view msg);
+/* Prints "Choices : a, b, c" after an argument's description. */
+NS_GETOPT_INLINE void print_choices(
+		const choice_view& choice, size_t indentation, bool indent);
 
-inline bool has_flag(const flag flags, flag flag_to_check);
+/* Prints "Aliases : --a, -b" after that, deprecated aliases left out. */
+NS_GETOPT_INLINE void print_aliases(
+		const argument& arg, size_t indentation, bool indent);
 
-} // namespace detail
+/* Name of the argument a slot points to. */
+NS_GETOPT_INLINE std::string_view slot_name(
+		const lookup_slot& slot, const argument* args);
 
+/* Prints the deprecation note of the alias spelled token, if any. */
+NS_GETOPT_INLINE void print_deprecation(
+		const argument& arg, std::string_view token, const options& option);
 
-/* Implementation. */
-inline argument::argument(std::string_view long_arg, type arg_type,
-		const std::function<bool()>& no_arg_func, std::string_view description,
-		char short_arg)
-		: no_arg_func(no_arg_func)
-		, long_arg(long_arg)
-		, description(description)
-		, multi_max_len(0)
-		, raw_arg_pos(-1)
-		, short_arg(short_arg)
-		, arg_type(arg_type)
-		, parsed(false) {
-	assert(arg_type == type::no_arg);
-	asserts();
+/* Reports the first violated constraint, in declaration order. */
+NS_GETOPT_INLINE bool check_constraints(const argument* args,
+		const constraint_view& rules, const uint64_t* present,
+		const options& option);
+
+/* Character classes of command strings, one load per character. */
+enum class command_char : std::uint8_t { plain, blank, special };
+constexpr std::array<command_char, 256> make_command_chars() {
+	std::array<command_char, 256> ret{};
+	for (unsigned char c : { ' ', '\t', '\n' }) {
+		ret[c] = command_char::blank;
+	}
+	for (unsigned char c : { '\0', '\'', '"', '\\' }) {
+		ret[c] = command_char::special;
+	}
+	return ret;
+}
+inline constexpr std::array<command_char, 256> command_chars
+		= make_command_chars();
+
+/* Reports a command string which couldn't be split. Exits on
+ * flag::exit_on_error. */
+NS_GETOPT_INLINE bool check_command(
+		const command_argv& command, const options& option);
+
+/* Prints version, then exits or returns false like do_exit. */
+NS_GETOPT_INLINE bool print_version(
+		std::string_view version, const options& option);
+
+/* ASCII case folding. Unlike std::tolower, no locale lookup per call and
+ * usable at compile time. */
+constexpr unsigned char to_lower(unsigned char c) {
+	return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
 }
 
-inline argument::argument(std::string_view long_arg, type arg_type,
-		const std::function<bool(std::string_view)>& one_arg_func,
-		std::string_view description, char short_arg,
-		std::string_view default_arg)
-		: one_arg_func(one_arg_func)
-		, long_arg(long_arg)
-		, description(description)
-		, default_arg(default_arg)
-		, multi_max_len(0)
-		, raw_arg_pos(-1)
-		, short_arg(short_arg)
-		, arg_type(arg_type)
-		, parsed(false) {
-	assert(arg_type == type::required_arg || arg_type == type::optional_arg
-			|| arg_type == type::default_arg || arg_type == type::raw_arg);
-	asserts();
+/* FNV-1a, 64 bits. */
+constexpr uint64_t fnv1a_64_basis = 14695981039346656037ull;
+constexpr uint64_t fnv1a_64(std::string_view s, uint64_t h = fnv1a_64_basis) {
+	for (char c : s) {
+		h ^= (unsigned char)c;
+		h *= 1099511628211ull;
+	}
+	return h;
 }
 
-inline argument::argument(std::string_view long_arg, type arg_type,
-		const std::function<bool(const multi_array&, size_t)>& multi_arg_func,
-		std::string_view description, char short_arg, size_t multi_max_subargs)
-		: multi_arg_func(multi_arg_func)
-		, long_arg(long_arg)
-		, description(description)
-		, multi_max_len(multi_max_subargs)
-		, raw_arg_pos(-1)
-		, short_arg(short_arg)
-		, arg_type(arg_type)
-		, parsed(false) {
-	assert(arg_type == type::multi_arg);
-	asserts();
+/* Case folded FNV-1a. */
+constexpr uint32_t hash_no_case(std::string_view s) {
+	uint32_t ret = 2166136261u;
+	for (char c : s) {
+		ret ^= to_lower(c);
+		ret *= 16777619u;
+	}
+	return ret;
 }
 
-inline void argument::asserts() {
-	assert(long_arg.find(" ") == std::string_view::npos
-			&& "One does not simply use spaces in his arguments.");
+constexpr bool in_char_class(unsigned char c, char_class cls) {
+	const bool is_lower = c >= 'a' && c <= 'z';
+	const bool is_upper = c >= 'A' && c <= 'Z';
+	const bool is_digit = c >= '0' && c <= '9';
+	return ((cls & lower) && is_lower) || ((cls & upper) && is_upper)
+			|| ((cls & digit) && is_digit)
+			|| ((cls & xdigit)
+					&& (is_digit || (to_lower(c) >= 'a' && to_lower(c) <= 'f')))
+			|| ((cls & space) && (c == ' ' || (c >= '\t' && c <= '\r')))
+			|| ((cls & punct) && c > ' ' && c < 127 && !is_lower && !is_upper
+					&& !is_digit);
 }
 
-inline options::options(std::string_view help_intro,
-		std::string_view help_outro, flag flags,
-		const std::function<bool(std::string_view)>& first_argument_func,
-		int exit_code)
-		: first_argument_func(first_argument_func)
-		, help_intro(help_intro)
-		, help_outro(help_outro)
-		, exit_code(exit_code)
-		, flags(flags) {
-}
+constexpr void add_chars(validator& v, char c) {
+	const unsigned char u = (unsigned char)c;
+	v.chars[u / 64] |= uint64_t(1) << (u % 64);
+}
+
+constexpr void add_chars(validator& v, char_class cls) {
+	for (size_t c = 0; c < 256; ++c) {
+		if (in_char_class((unsigned char)c, cls))
+			v.chars[c / 64] |= uint64_t(1) << (c % 64);
+	}
+}
+
+/* compare_no_case, usable at compile time. */
+constexpr bool equal_no_case(std::string_view lhs, std::string_view rhs) {
+	if (lhs.size() != rhs.size())
+		return false;
+	for (size_t i = 0; i < lhs.size(); ++i) {
+		if (to_lower(lhs[i]) != to_lower(rhs[i]))
+			return false;
+	}
+	return true;
+}
+
+/* Multiplicative hashing, top bits of the case folded hash. */
+constexpr size_t choice_slot(
+		std::string_view s, uint32_t multiplier, uint32_t shift) {
+	return uint32_t(hash_no_case(s) * multiplier) >> shift;
+}
+
+NS_GETOPT_INLINE bool char_compare_no_case(
+		unsigned char lhs, unsigned char rhs);
+
+NS_GETOPT_INLINE bool compare_no_case(const char* lhs, std::string_view rhs,
+		const size_t lhs_start_pos = 0, const size_t rhs_start_pos = 0);
+
+NS_GETOPT_INLINE bool compare_no_case(std::string_view lhs,
+		std::string_view rhs, const size_t lhs_start_pos = 0,
+		const size_t rhs_start_pos = 0);
+
+NS_GETOPT_INLINE void maybe_print_msg(const options& option, stack_string msg);
+NS_GETOPT_INLINE void maybe_print_msg(
+		const options& option, std::string_view msg);
+
+inline bool has_flag(const flag flags, flag flag_to_check);
+
+} // namespace detail
+
+/* An argument found by event_parser. */
+struct option_event {
+	int id = -1; // Index in the argument table.
+	int argv_index = -1; // First occurrence if repeatable.
+	std::string_view value; // Single value, may point to default_arg.
+	argv_span values; // In argv, or collected list_arg values.
+	int count = 0; // Occurrences.
+};
+
+/**
+ * Pull parser. Each next parses argv just far enough to return the next
+ * argument found, so a caller stopping early skips the rest. Handle
+ * arguments in a loop, no callback is called besides
+ * options::first_argument_func. Values are checked against choices and
+ * validators. count_arg and list_arg come after every other argument,
+ * constraints are checked last. An error ends the iteration, as it would
+ * fail parse_arguments.
+ *
+ *   opt::event_parser parser(argc, argv, args, table, option);
+ *   for (const opt::option_event& ev : parser) { ... }
+ *
+ * Resets argument::parsed first. args, table and option must outlive the
+ * parser, views in events point into argv or the parser.
+ **/
+struct event_parser {
+	template <size_t args_size>
+	event_parser(int argc, char const* const* argv,
+			std::array<argument, args_size>& args,
+			compiled_table<args_size>& table, const options& option);
+	template <size_t args_size>
+	event_parser(int argc, char const* const* argv,
+			argument (&args)[args_size], compiled_table<args_size>& table,
+			const options& option);
+
+	event_parser(const event_parser&) = delete;
+	event_parser& operator=(const event_parser&) = delete;
+
+	/* Parses up to the next argument. False once done, or on error. */
+	NS_GETOPT_INLINE bool next(option_event& ev);
+
+	/* Whether parsing stopped on an error, help included. */
+	bool failed() const {
+		return _parser.failed;
+	}
+
+	/* Input iterator, advancing calls next. */
+	struct iterator {
+		event_parser* parser = nullptr; // Null once done.
+		option_event ev;
+
+		const option_event& operator*() const {
+			return ev;
+		}
+		const option_event* operator->() const {
+			return &ev;
+		}
+		iterator& operator++() {
+			if (!parser->next(ev))
+				parser = nullptr;
+			return *this;
+		}
+		bool operator==(const iterator& rhs) const {
+			return parser == rhs.parser;
+		}
+		bool operator!=(const iterator& rhs) const {
+			return parser != rhs.parser;
+		}
+	};
+
+	iterator begin() {
+		iterator ret{ this, {} };
+		return ++ret;
+	}
+	iterator end() {
+		return {};
+	}
+
+private:
+	NS_GETOPT_INLINE event_parser(int argc, char const* const* argv,
+			argument* args, size_t args_size,
+			const detail::lookup_table& table, const options& option);
+
+	detail::lookup_table _table;
+	std::pmr::vector<char const*> _list_values;
+	detail::token_parser _parser;
+};
+
+/* Implementation. */
 
 template <size_t args_size>
 inline void print_help(const std::array<argument, args_size>& args,
@@ -273,149 +1335,370 @@ inline void print_help(const argument (&args)[args_size], const char* arg0,
 	print_help(args, args_size, arg0, option);
 }
 
-inline void print_help(const argument* args, size_t args_size, const char* arg0,
-		const options& option) {
+template <size_t args_size>
+inline void print_completion(const std::array<argument, args_size>& args,
+		const char* arg0, shell sh) {
+	print_completion(args.data(), args.size(), arg0, sh);
+}
+
+template <size_t args_size>
+inline void print_completion(
+		const argument (&args)[args_size], const char* arg0, shell sh) {
+	print_completion(args, args_size, arg0, sh);
+}
+
+template <class Func>
+inline void complete(const argument* args, size_t args_size, int words_size,
+		char const* const* words, Func&& func) {
 	using namespace detail;
 
-	const size_t first_space = 1;
-	const size_t sa_width = 4;
-	const size_t sa_total_width = first_space + sa_width;
-	const size_t la_space = 2;
-	const size_t la_width_max = 30;
-	const size_t ra_space = 4;
-	const std::string_view opt_str = " <optional>";
-	const std::string_view req_str = " <value>";
-	const std::string_view multi_str = " <multiple>";
-	const std::string_view default_beg = " <=";
-	const std::string_view default_end = ">";
-
-	printf("%.*s\n", (int)option.help_intro.size(), option.help_intro.data());
-
-	{ /* Usage. */
-		bool args_optional
-				= has_flag(option.flags, flag::arguments_are_optional);
-		stack_string raw_args;
-		bool first = args_optional;
-		for (const argument* x = args; x < args + args_size; x++) {
-			if (x->arg_type == type::raw_arg) {
-				raw_args += (first ? " [" : " ");
-				raw_args += x->long_arg;
-				first = false;
-			}
-		}
-		if (args_optional && raw_args.size() > 0) {
-			raw_args += "]";
-		}
+	if (words_size <= 0)
+		return;
 
-		printf("\nUsage: %s%s [options]\n\n", arg0, raw_args.c_str());
-	}
+	const std::string_view cur = words[words_size - 1];
 
-	{ /* Raw args. */
-		bool has_raw_args = false;
-		size_t name_width = 0;
+	/* Completing the value of an option, leave it to the shell. */
+	if (words_size >= 2 && (cur.empty() || cur[0] != '-')) {
+		const std::string_view prev = words[words_size - 2];
 		for (const argument* x = args; x < args + args_size; x++) {
-			if (x->arg_type != type::raw_arg)
+			if (is_positional(*x))
 				continue;
 
-			has_raw_args = true;
-			size_t s = x->long_arg.size() + ra_space;
-			if (s > name_width)
-				name_width = s;
+			bool is_long = prev.size() > 2 && prev[1] == '-'
+					&& compare_no_case(prev, x->long_arg, 2);
+			bool is_short = prev.size() == 2 && prev[0] == '-'
+					&& prev[1] == x->short_arg;
+			if ((is_long || is_short) && takes_value(*x))
+				return;
 		}
+	}
 
-		if (has_raw_args)
-			printf("Arguments:\n");
+	if (cur.empty() || cur[0] != '-')
+		return;
 
+	/* Single short argument. */
+	if (cur.size() <= 2 && (cur.size() == 1 || cur[1] != '-')) {
 		for (const argument* x = args; x < args + args_size; x++) {
-			if (x->arg_type != type::raw_arg)
+			if (is_positional(*x) || x->short_arg == '\0')
 				continue;
-			printf("%*s", (int)first_space, "");
-			printf("%-*.*s", (int)name_width, (int)x->long_arg.size(),
-					x->long_arg.data());
-			print_description(x->description, first_space + name_width);
+			if (cur.size() == 1 || cur[1] == x->short_arg)
+				func(std::string_view("-"), std::string_view(&x->short_arg, 1));
 		}
-		if (has_raw_args)
-			printf("\n");
+		if (cur.size() == 2)
+			return;
 	}
 
-	{ /* Other args.*/
-		printf("Options:\n");
-		size_t la_width = 0;
-		for (const argument* x = args; x < args + args_size; x++) {
-			if (x->arg_type == type::raw_arg)
-				continue;
+	/* Long arguments, through an index of the candidates only. A one shot
+	 * completion process would spend more building the whole index than
+	 * it saves on lookup. */
+	if (cur.size() == 1 || cur[1] == '-') {
+		const std::string_view prefix
+				= cur.substr(std::min(cur.size(), size_t(2)));
+		trie index;
+		index.build(args, args_size, prefix);
+		index.for_each_prefixed(prefix, [&](int arg_index) {
+			func(std::string_view("--"), args[arg_index].long_arg);
+			return true;
+		});
+	}
+}
 
-			size_t s = 2 + x->long_arg.size() + la_space;
-			if (x->arg_type == type::optional_arg) {
-				s += opt_str.size();
-			} else if (x->arg_type == type::required_arg) {
-				s += req_str.size();
-			} else if (x->arg_type == type::default_arg) {
-				s += default_beg.size() + x->default_arg.size()
-						+ default_end.size();
-			} else if (x->arg_type == type::multi_arg) {
-				s += multi_str.size();
-			}
+template <size_t args_size>
+compiled_table<args_size>::compiled_table(
+		const std::array<argument, args_size>& args) {
+	build(args.data());
+}
+
+template <size_t args_size>
+compiled_table<args_size>::compiled_table(const argument (&args)[args_size]) {
+	build(args);
+}
+
+template <size_t args_size>
+compiled_table<args_size>::compiled_table(const argument* args) {
+	build(args);
+}
+
+template <size_t args_size>
+template <size_t rules_size>
+compiled_table<args_size>::compiled_table(
+		const std::array<argument, args_size>& args,
+		const constraints<args_size, rules_size>& rules) {
+	build(args.data());
+	constrain(rules);
+}
+
+template <size_t args_size>
+template <size_t rules_size>
+compiled_table<args_size>::compiled_table(const argument* args,
+		const constraints<args_size, rules_size>& rules) {
+	build(args);
+	constrain(rules);
+}
+
+template <size_t args_size>
+template <size_t rules_size>
+void compiled_table<args_size>::constrain(
+		const constraints<args_size, rules_size>& rules) {
+	_constraints = rules.view();
+}
+
+template <size_t args_size>
+void compiled_table<args_size>::build(const argument* args) {
+	detail::lookup_table t = table();
+	t.build(args, args_size);
+	_positionals_size = t.positionals_size;
+	_variadic_arg = t.variadic_arg;
+	_overflow_begin = t.overflow_begin;
+	_overflow_end = t.overflow_end;
+}
+
+template <size_t args_size>
+detail::lookup_table compiled_table<args_size>::table() {
+	return { _slots.data(), _slots.size() - 1, _short_args.data(),
+		_types.data(), _positionals.data(), _positionals_size,
+		_variadic_arg,
+		_constraints.required != nullptr ? &_constraints : nullptr,
+		_present.data(), _overflow_begin, _overflow_end };
+}
+
+constexpr validator in_range(int64_t min, int64_t max) {
+	validator ret{ validator::check::in_range };
+	ret.min = min;
+	ret.max = max;
+	return ret;
+}
+
+constexpr validator min_len(size_t len) {
+	validator ret{ validator::check::length };
+	ret.min = (int64_t)len;
+	ret.max = INT64_MAX;
+	return ret;
+}
+
+constexpr validator max_len(size_t len) {
+	validator ret{ validator::check::length };
+	ret.max = (int64_t)len;
+	return ret;
+}
+
+template <class... Chars>
+constexpr validator charset(Chars... chars) {
+	validator ret{ validator::check::charset };
+	(detail::add_chars(ret, chars), ...);
+	return ret;
+}
+
+constexpr validator path_exists() {
+	return { validator::check::path_exists };
+}
+
+template <size_t names_size>
+constexpr validator one_of(const std::string_view (&names)[names_size]) {
+	validator ret{ validator::check::one_of };
+	ret.names = names;
+	ret.names_size = names_size;
+	return ret;
+}
+
+template <size_t list_size>
+argument& argument::validate(const validator (&list)[list_size]) {
+	validators = list;
+	validators_size = list_size;
+	return *this;
+}
+
+template <size_t list_size>
+argument& argument::known_as(const alias (&list)[list_size]) {
+	aliases = list;
+	aliases_size = list_size;
+	asserts();
+	return *this;
+}
 
-			if (s > la_width)
-				la_width = s;
+template <class Enum, size_t choices_size>
+constexpr choices<Enum, choices_size>::choices(
+		const choice<Enum> (&list)[choices_size]) {
+	for (size_t i = 0; i < choices_size; ++i) {
+		if (list[i].name.empty())
+			detail::table_error("Empty choice.");
+		for (size_t j = 0; j < i; ++j) {
+			if (detail::equal_no_case(list[i].name, list[j].name))
+				detail::table_error("Duplicate choice.");
 		}
+		names[i] = list[i].name;
+		values[i] = list[i].value;
+	}
+
+	shift = 32;
+	for (size_t s = slots_size; s > 1; s >>= 1) {
+		--shift;
+	}
 
-		if (la_width > la_width_max) {
-			la_width = la_width_max;
+	/* Odd multipliers around the golden ratio, until no name collides.
+	 * A quarter full table finds one in a few tries. */
+	for (uint32_t seed = 0; seed < 4096; ++seed) {
+		multiplier = 2654435769u + seed * 2;
+		for (int16_t& x : slots) {
+			x = -1;
 		}
 
-		for (const argument* x = args; x < args + args_size; x++) {
-			if (x->arg_type == type::raw_arg)
-				continue;
+		bool collides = false;
+		for (size_t i = 0; i < choices_size && !collides; ++i) {
+			size_t s = detail::choice_slot(names[i], multiplier, shift);
+			collides = slots[s] != -1;
+			slots[s] = (int16_t)i;
+		}
+		if (!collides)
+			return;
+	}
+	detail::table_error("No perfect hash found.");
+}
 
-			printf("%*s", (int)first_space, "");
+template <class Enum, size_t choices_size>
+constexpr const Enum* choices<Enum, choices_size>::find(
+		std::string_view s) const {
+	const int16_t i = slots[detail::choice_slot(s, multiplier, shift)];
+	if (i == -1 || !detail::equal_no_case(s, names[i]))
+		return nullptr;
+	return &values[i];
+}
 
-			if (x->short_arg != '\0') {
-				stack_string s_arg;
-				s_arg += "-";
-				s_arg += x->short_arg;
-				s_arg += ",";
-				printf("%-*s", (int)sa_width, s_arg.c_str());
-			} else {
-				printf("%*s", (int)sa_width, "");
-			}
+template <class Enum, size_t choices_size>
+detail::choice_view choices<Enum, choices_size>::view() const {
+	return { names.data(), slots.data(), multiplier, shift, choices_size };
+}
 
-			stack_string la_str;
-			la_str += "--";
-			la_str += x->long_arg;
-			if (x->arg_type == type::optional_arg) {
-				la_str += opt_str;
-			} else if (x->arg_type == type::required_arg) {
-				la_str += req_str;
-			} else if (x->arg_type == type::default_arg) {
-				la_str += default_beg;
-				la_str += x->default_arg;
-				la_str += default_end;
-			} else if (x->arg_type == type::multi_arg) {
-				la_str += multi_str;
-			}
+template <class Enum, size_t choices_size>
+constexpr choices<Enum, choices_size> make_choices(
+		const choice<Enum> (&list)[choices_size]) {
+	return choices<Enum, choices_size>(list);
+}
 
-			printf("%-*s", (int)la_width, la_str.c_str());
+template <class Enum, size_t choices_size>
+argument::argument(std::string_view long_arg, type arg_type,
+		const choices<Enum, choices_size>& allowed,
+		const typename choices<Enum, choices_size>::callback& func,
+		std::string_view description, char short_arg,
+		std::string_view default_arg)
+		: one_arg_func(func == nullptr
+						  ? std::function<bool(std::string_view)>{}
+						  : [&allowed, func](std::string_view s) {
+								  return func(*allowed.find(s));
+							  })
+		, long_arg(long_arg)
+		, description(description)
+		, default_arg(default_arg)
+		, choice(allowed.view())
+		, multi_max_len(0)
+		, raw_arg_pos(-1)
+		, short_arg(short_arg)
+		, arg_type(arg_type)
+		, parsed(false) {
+	assert((arg_type == type::required_arg || arg_type == type::default_arg
+				   || arg_type == type::raw_arg)
+			&& "Choices need a value.");
+	assert((arg_type != type::default_arg
+				   || allowed.find(default_arg) != nullptr)
+			&& "default_arg must be one of the choices.");
+	asserts();
+}
 
-			// TODO: Verify comparison is still ok (size works as exapected).
-			if (la_str.size() >= la_width) {
-				printf("\n");
-				printf("%*s", (int)(la_width + sa_total_width), "");
-			}
+template <class Enum, size_t choices_size>
+argument::argument(std::string_view long_arg, type arg_type,
+		const choices<Enum, choices_size>& allowed,
+		std::string_view description, char short_arg,
+		std::string_view default_arg)
+		: argument(long_arg, arg_type, allowed, nullptr, description,
+				short_arg, default_arg) {
+}
 
-			print_description(x->description, la_width + sa_total_width);
+template <size_t args_size, size_t rules_size>
+constexpr constraints<args_size, rules_size>::constraints(
+		const constraint (&rules)[rules_size]) {
+	for (const constraint& c : rules) {
+		if (c.arg >= args_size
+				|| (c.kind != rule::required && c.other >= args_size))
+			detail::table_error("Constraint argument out of range.");
+
+		if (c.kind == rule::required) {
+			required[c.arg / 64] |= uint64_t(1) << (c.arg % 64);
+			continue;
 		}
+		if (c.arg == c.other)
+			detail::table_error("Argument constrained by itself.");
+
+		size_t e = 0;
+		while (e < entries_size
+				&& (entries[e].arg != (int16_t)c.arg
+						|| entries[e].kind != c.kind)) {
+			++e;
+		}
+		if (e == entries_size)
+			entries[entries_size++] = { (int16_t)c.arg, c.kind };
+		masks[e * words + c.other / 64] |= uint64_t(1) << (c.other % 64);
+	}
 
-		if (la_width == 0) // No options, width is --help only.
-			la_width = 2 + 4 + la_space;
+	for (size_t e = 0; e < entries_size; ++e) {
+		if (entries[e].kind != rule::depends)
+			continue;
+		bitset set{};
+		set[entries[e].arg / 64] |= uint64_t(1) << (entries[e].arg % 64);
+		if (self_conflicting(closure(set)))
+			detail::table_error(
+					"Argument conflicts with one of its dependencies.");
+	}
+	if (self_conflicting(closure(required)))
+		detail::table_error("Required arguments conflict.");
+}
+
+template <size_t args_size, size_t rules_size>
+detail::constraint_view constraints<args_size, rules_size>::view() const {
+	return { required.data(), entries.data(), masks.data(), entries_size,
+		words };
+}
 
-		printf("%*s%-*s%-*s%s\n", (int)first_space, "", (int)sa_width, "-h,",
-				(int)la_width, "--help", "Print this help\n");
+template <size_t args_size, size_t rules_size>
+constexpr auto constraints<args_size, rules_size>::closure(bitset set) const
+		-> bitset {
+	/* Adds dependencies until nothing changes. */
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (size_t e = 0; e < entries_size; ++e) {
+			const size_t a = entries[e].arg;
+			if (entries[e].kind != rule::depends
+					|| (set[a / 64] & (uint64_t(1) << (a % 64))) == 0)
+				continue;
+			for (size_t w = 0; w < words; ++w) {
+				const uint64_t next = set[w] | masks[e * words + w];
+				changed |= next != set[w];
+				set[w] = next;
+			}
+		}
+	}
+	return set;
+}
 
-		printf("\n%.*s\n", (int)option.help_outro.size(),
-				option.help_outro.data());
+template <size_t args_size, size_t rules_size>
+constexpr bool constraints<args_size, rules_size>::self_conflicting(
+		const bitset& set) const {
+	for (size_t e = 0; e < entries_size; ++e) {
+		const size_t a = entries[e].arg;
+		if (entries[e].kind != rule::conflicts
+				|| (set[a / 64] & (uint64_t(1) << (a % 64))) == 0)
+			continue;
+		for (size_t w = 0; w < words; ++w) {
+			if ((set[w] & masks[e * words + w]) != 0)
+				return true;
+		}
 	}
+	return false;
+}
+
+template <size_t args_size, size_t rules_size>
+constexpr constraints<args_size, rules_size> make_constraints(
+		const constraint (&rules)[rules_size]) {
+	return constraints<args_size, rules_size>(rules);
 }
 
 template <size_t args_size>
@@ -438,300 +1721,300 @@ inline bool parse_arguments(int argc, char const* const* argv,
 template <size_t args_size>
 inline bool parse_arguments(int argc, char const* const* argv, argument* args,
 		const options& option) {
-	using namespace detail;
+	compiled_table<args_size> table(args);
+	return parse_arguments<args_size>(argc, argv, args, table, option);
+}
 
-	/* Prepare raw_args, they are parsed in declared order. */
-	int parsed_raw_args = 0;
-	int raw_args_count = 0;
-	for (argument* x = args; x < args + args_size; x++) {
-		if (x->arg_type == type::raw_arg)
-			x->raw_arg_pos = raw_args_count++;
-	}
+template <size_t args_size>
+inline bool parse_arguments(int argc, char const* const* argv,
+		std::array<argument, args_size>& args,
+		compiled_table<args_size>& table, const options& option) {
+	return parse_arguments<args_size>(argc, argv, args.data(), table, option);
+}
 
-	for (int i = 0; i < argc; ++i) {
-		/* First argument is a special snowflake. */
-		if (i == 0 && !has_flag(option.flags, flag::arg0_is_normal_argument)) {
-			if (argc == 1
-					&& !has_flag(option.flags, flag::arguments_are_optional)) {
-				return do_exit(args, args_size, option, argv[0]);
-			} else {
-				option.first_argument_func(argv[i]);
-			}
-		}
+template <size_t args_size>
+inline bool parse_arguments(int argc, char const* const* argv, argument* args,
+		compiled_table<args_size>& table, const options& option) {
+	/* Every argument matches at most once, so args_size bounds the
+	 * deferred event list. */
+	std::array<detail::parse_event, args_size> events;
+	return detail::parse_and_dispatch(
+			argc, argv, args, args_size, table.table(), events.data(), option);
+}
 
-		/* Help. */
-		else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0
-				|| strcmp(argv[i], "/?") == 0) {
-			return do_exit(args, args_size, option, argv[0]);
-		}
+template <size_t args_size>
+inline bool parse_arguments(argv_span argv,
+		std::array<argument, args_size>& args, const options& option) {
+	return parse_arguments<args_size>(
+			(int)argv.size, argv.data, args.data(), option);
+}
 
-		/* Check single short arg and long args. */
-		else if ((strncmp(argv[i], "-", 1) == 0 && strlen(argv[i]) == 2)
-				|| strncmp(argv[i], "--", 2) == 0) {
-			int found = -1;
-			for (int j = 0; j < (int)args_size; ++j) {
-				if (compare_no_case(argv[i], args[j].long_arg, 2)) {
-					found = j;
-					break;
-				}
-			}
+template <size_t args_size>
+inline bool parse_arguments(argv_span argv, argument (&args)[args_size],
+		const options& option) {
+	return parse_arguments<args_size>(
+			(int)argv.size, argv.data, (argument*)args, option);
+}
 
-			if (found == -1) {
-				for (int j = 0; j < (int)args_size; ++j) {
-					if (argv[i][1] == args[j].short_arg) {
-						found = j;
-						break;
-					}
-				}
-			}
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer,
+		std::array<argument, args_size>& args, const options& option) {
+	const buffer_argv b(buffer, option.resource);
+	return parse_arguments<args_size>(b.argc, b.argv, args.data(), option);
+}
 
-			if (found == -1) {
-				maybe_print_msg(option,
-						make_stack_string("'", argv[i], "' not found."));
-				return do_exit(args, args_size, option, argv[0]);
-			}
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer,
+		argument (&args)[args_size], const options& option) {
+	const buffer_argv b(buffer, option.resource);
+	return parse_arguments<args_size>(
+			b.argc, b.argv, (argument*)args, option);
+}
 
-			if (args[found].parsed) {
-				maybe_print_msg(option,
-						make_stack_string("'", argv[i], "' already parsed."));
-				return do_exit(args, args_size, option, argv[0]);
-			}
+template <size_t args_size>
+inline bool parse_arguments(std::string_view buffer, argument* args,
+		compiled_table<args_size>& table, const options& option) {
+	const buffer_argv b(buffer, option.resource);
+	return parse_arguments<args_size>(b.argc, b.argv, args, table, option);
+}
 
-			argument& found_arg = args[found];
-			found_arg.parsed = true;
-			std::string_view default_arg = found_arg.default_arg;
-
-			switch (found_arg.arg_type) {
-			case type::no_arg: {
-				if (!found_arg.no_arg_func()) {
-					maybe_print_msg(option,
-							make_stack_string("problem parsing option."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-			} break;
-
-			case type::required_arg: {
-				if (i + 1 >= argc) {
-					maybe_print_msg(option,
-							make_stack_string(
-									"'", argv[i], "' requires 1 argument."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-
-				if (strncmp(argv[i + 1], "-", 1) == 0) {
-					maybe_print_msg(option,
-							make_stack_string(
-									"'", argv[i], "' requires 1 argument."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-				if (!found_arg.one_arg_func(argv[++i])) {
-					maybe_print_msg(option,
-							make_stack_string("'", argv[i - 1],
-									"' problem parsing argument."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-			} break;
-
-			case type::optional_arg: {
-				default_arg = "";
-				[[fallthrough]];
-			}
-			case type::default_arg: {
-				if (i + 1 >= argc) {
-					if (!found_arg.one_arg_func(std::move(default_arg))) {
-						maybe_print_msg(option,
-								make_stack_string("problem parsing option."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-					break;
-				}
-
-				if (strncmp(argv[i + 1], "-", 1) == 0) {
-					if (!found_arg.one_arg_func(std::move(default_arg))) {
-						maybe_print_msg(option,
-								make_stack_string("problem parsing option."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-					break;
-				}
-
-				if (!found_arg.one_arg_func(argv[++i])) {
-					maybe_print_msg(option,
-							make_stack_string("problem parsing option."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-			} break;
-
-			case type::multi_arg: {
-				multi_array a;
-				size_t current_multi_arg = 0;
-
-				while (i + 1 < argc) {
-					// Found next option. Stop parsing.
-					if (strncmp(argv[i + 1], "-", 1) == 0) {
-						break;
-					}
-
-					a[current_multi_arg] = argv[++i];
-					++current_multi_arg;
-
-					if (current_multi_arg - 1 >= found_arg.multi_max_len) {
-						char buf[3] = {};
-						snprintf(buf, sizeof(buf), "%zu",
-								found_arg.multi_max_len);
-						maybe_print_msg(option,
-								make_stack_string("'", found_arg.long_arg,
-										"' only supports ", buf,
-										" arguments."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-				}
-				if (!found_arg.multi_arg_func(a, current_multi_arg)) {
-					maybe_print_msg(option,
-							make_stack_string(
-									"problem parsing multi-arguments."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-			} break;
-
-			default: {
-				// assert(false && "Something went horribly wrong.");
-				maybe_print_msg(
-						option, make_stack_string("problem parsing options."));
-				return do_exit(args, args_size, option, argv[0]);
-			};
-			}
-		}
+template <size_t args_size>
+inline bool parse_command(char* command,
+		std::array<argument, args_size>& args, const options& option) {
+	const command_argv c(command, option.resource);
+	return detail::check_command(c, option)
+			&& parse_arguments<args_size>(c.argc, c.argv, args.data(), option);
+}
 
-		/* Concatenated short args. */
-		else if (strncmp(argv[i], "-", 1) == 0 && strlen(argv[i]) > 2) {
-			std::array<int, args_size> found_v;
-			found_v.fill(args_size + 1);
-			size_t found_size = 0;
-			stack_string not_found;
-			for (size_t j = 1; j < strlen(argv[i]); ++j) {
-				bool found = false;
-				for (int k = 0; k < (int)args_size; ++k) {
-					if (argv[i][j] == args[k].short_arg) {
-						found_v[found_size] = k;
-						++found_size;
-						found = true;
-						break;
-					}
-				}
-				if (!found) {
-					not_found += argv[i][j];
-				}
-			}
+template <size_t args_size>
+inline bool parse_command(char* command, argument (&args)[args_size],
+		const options& option) {
+	const command_argv c(command, option.resource);
+	return detail::check_command(c, option)
+			&& parse_arguments<args_size>(
+					c.argc, c.argv, (argument*)args, option);
+}
 
-			if (found_size == 0) {
-				maybe_print_msg(option,
-						make_stack_string("'", argv[i], "' not found."));
-				return do_exit(args, args_size, option, argv[0]);
-			}
+template <size_t args_size>
+inline bool parse_command(char* command, argument* args,
+		compiled_table<args_size>& table, const options& option) {
+	const command_argv c(command, option.resource);
+	return detail::check_command(c, option)
+			&& parse_arguments<args_size>(
+					c.argc, c.argv, args, table, option);
+}
 
-			if (not_found.size() != 0) {
-				maybe_print_msg(option,
-						make_stack_string(
-								"'", not_found.c_str(), "' not found."));
-				return do_exit(args, args_size, option, argv[0]);
-			}
+template <class Factory>
+inline bool parse_arguments_lazy(int argc, char const* const* argv,
+		Factory&& make_args, std::string_view version,
+		const options& option) {
+	if (!version.empty()
+			&& prescan(argc, argv, option) == early_exit::version)
+		return detail::print_version(version, option);
 
-			/* Accept duplicate flags because who cares. */
-			std::sort(found_v.begin(), found_v.end());
-			auto last = std::unique(found_v.begin(), found_v.end());
-			found_size = last - found_v.begin() - 1;
-
-			for (size_t j = 0; j < found_size; ++j) {
-				const auto& x = found_v[j];
-				if (args[x].parsed) {
-					maybe_print_msg(option,
-							make_stack_string("'", args[x].short_arg,
-									"' already parsed."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-
-				if (!(args[x].arg_type == type::no_arg
-							|| args[x].arg_type == type::optional_arg
-							|| args[x].arg_type == type::default_arg)) {
-
-					maybe_print_msg(option,
-							make_stack_string("'", args[x].short_arg,
-									"' unsupported in concatenated short "
-									"arguments."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
-			}
+	auto args = make_args();
+	return parse_arguments(argc, argv, args, option);
+}
+
+inline parse_result::parse_result(parsed_arg* buffer, size_t buffer_size,
+		std::pmr::memory_resource* resource)
+		: data(buffer)
+		, size(buffer_size)
+		, list_values(resource) {
+	clear();
+}
+
+inline bool parse_result::has(size_t id) const {
+	assert(id < size);
+	return data[id].argv_index != -1;
+}
+
+inline std::string_view parse_result::get(size_t id) const {
+	assert(id < size);
+	return data[id].value;
+}
+
+inline argv_span parse_result::values(size_t id) const {
+	assert(id < size);
+	if (data[id].values == nullptr)
+		return {};
+	return { data[id].values, (size_t)data[id].values_count };
+}
+
+inline int parse_result::position(size_t id) const {
+	assert(id < size);
+	return data[id].argv_index;
+}
+
+inline size_t parse_result::count(size_t id) const {
+	assert(id < size);
+	return (size_t)data[id].count;
+}
+
+inline void parse_result::clear() {
+	std::fill(data, data + size, parsed_arg{});
+	argv = nullptr;
+	list_values.clear();
+}
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, parse_result& result,
+		const options& option) {
+	return parse_results<args_size>(argc, argv, args.data(), result, option);
+}
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv,
+		argument (&args)[args_size], parse_result& result,
+		const options& option) {
+	return parse_results<args_size>(
+			argc, argv, (argument*)args, result, option);
+}
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		parse_result& result, const options& option) {
+	compiled_table<args_size> table(args);
+	return parse_results<args_size>(argc, argv, args, table, result, option);
+}
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		compiled_table<args_size>& table, parse_result& result,
+		const options& option) {
+	return detail::parse_into(
+			argc, argv, args, args_size, table.table(), result, option);
+}
+
+template <size_t args_size>
+inline bool parse_results(int argc, char const* const* argv, argument* args,
+		const prebuilt_table& table, parse_result& result,
+		const options& option) {
+	return detail::parse_into(
+			argc, argv, args, args_size, table.table(), result, option);
+}
+
+template <size_t args_size>
+event_parser::event_parser(int argc, char const* const* argv,
+		std::array<argument, args_size>& args,
+		compiled_table<args_size>& table, const options& option)
+		: event_parser(argc, argv, args.data(), args_size, table.table(),
+				option) {
+}
+
+template <size_t args_size>
+event_parser::event_parser(int argc, char const* const* argv,
+		argument (&args)[args_size], compiled_table<args_size>& table,
+		const options& option)
+		: event_parser(argc, argv, args, args_size, table.table(), option) {
+}
+
+template <size_t args_size, class Func>
+inline bool canonicalize(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, Func&& func,
+		const options& option) {
+	return canonicalize<args_size>(
+			argc, argv, args.data(), std::forward<Func>(func), option);
+}
+
+template <size_t args_size, class Func>
+inline bool canonicalize(int argc, char const* const* argv, argument* args,
+		Func&& func, const options& option) {
+	using namespace detail;
+
+	std::array<parsed_arg, args_size> buffer;
+	parse_result result(buffer.data(), buffer.size(), option.resource);
+	if (!parse_results<args_size>(argc, argv, args, result, option))
+		return false;
 
-			for (size_t j = 0; j < found_size; ++j) {
-				const auto& x = found_v[j];
-				if (args[x].arg_type == type::no_arg) {
-					args[x].parsed = true;
-					if (!args[x].no_arg_func()) {
-						maybe_print_msg(option,
-								make_stack_string("'", args[x].short_arg,
-										"' problem parsing option."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-				} else if (args[x].arg_type == type::optional_arg) {
-					args[x].parsed = true;
-					if (!args[x].one_arg_func("")) {
-						maybe_print_msg(option,
-								make_stack_string("'", args[x].short_arg,
-										"' problem parsing argument."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-				} else if (args[x].arg_type == type::default_arg) {
-					args[x].parsed = true;
-					if (!args[x].one_arg_func(args[x].default_arg)) {
-						maybe_print_msg(option,
-								make_stack_string("'", args[x].short_arg,
-										"' problem parsing argument."));
-						return do_exit(args, args_size, option, argv[0]);
-					}
-				} else {
-					maybe_print_msg(option,
-							make_stack_string("'", args[x].short_arg,
-									"' problem parsing argument."));
-					return do_exit(args, args_size, option, argv[0]);
-				}
+	/* Choices match in any case, emit their declared spelling. */
+	auto spelled = [&](size_t i, std::string_view v) {
+		const int c = args[i].choice.size != 0 ? args[i].choice.find(v) : -1;
+		return c == -1 ? v : args[i].choice.names[c];
+	};
+
+	auto values = [&](size_t i) {
+		const argv_span span = result.values(i);
+		if (args[i].arg_type == type::multi_arg
+				|| args[i].arg_type == type::variadic_arg) {
+			for (std::string_view v : span) {
+				func(std::string_view(), v);
 			}
+		} else if (!span.empty() || args[i].arg_type == type::default_arg) {
+			func(std::string_view(), spelled(i, result.get(i)));
 		}
+	};
 
-		/* Check raw args. */
-		else if (parsed_raw_args < raw_args_count) {
-			int found = -1;
-			for (int j = 0; j < (int)args_size; ++j) {
-				if (args[j].raw_arg_pos == parsed_raw_args) {
-					found = j;
-					break;
-				}
-			}
-			if (found == -1)
-				continue;
+	for (size_t i = 0; i < args_size; ++i) {
+		if (!result.has(i) || is_positional(args[i]))
+			continue;
 
-			argument& found_arg = args[found];
-			found_arg.parsed = true;
-			++parsed_raw_args;
-			if (!found_arg.one_arg_func(argv[i])) {
-				maybe_print_msg(option,
-						make_stack_string(
-								"'", argv[i], "' problem parsing argument."));
-				return do_exit(args, args_size, option, argv[0]);
+		auto name = [&]() {
+			if (!args[i].long_arg.empty()) {
+				func(std::string_view("--"), args[i].long_arg);
+			} else {
+				func(std::string_view("-"),
+						std::string_view(&args[i].short_arg, 1));
 			}
+		};
+
+		/* Repeated, in argv order. */
+		if (is_repeatable(args[i])) {
+			const argv_span span = result.values(i);
+			for (size_t j = 0; j < result.count(i); ++j) {
+				name();
+				if (!span.empty())
+					func(std::string_view(), span[j]);
+			}
+			continue;
 		}
 
-		/* Everything failed. */
-		else {
-			maybe_print_msg(
-					option, make_stack_string("'", argv[i], "' unrecognized."));
-			return do_exit(args, args_size, option, argv[0]);
-		}
+		name();
+		values(i);
 	}
 
+	for (size_t i = 0; i < args_size; ++i) {
+		if (result.has(i) && args[i].arg_type == type::raw_arg)
+			values(i);
+	}
+	for (size_t i = 0; i < args_size; ++i) {
+		if (result.has(i) && args[i].arg_type == type::variadic_arg)
+			values(i);
+	}
 	return true;
 }
 
+template <size_t args_size>
+inline bool canonical_hash(int argc, char const* const* argv,
+		std::array<argument, args_size>& args, uint64_t& hash,
+		const options& option) {
+	return canonical_hash<args_size>(argc, argv, args.data(), hash, option);
+}
+
+template <size_t args_size>
+inline bool canonical_hash(int argc, char const* const* argv, argument* args,
+		uint64_t& hash, const options& option) {
+	using namespace detail;
+
+	/* Tokens are NUL terminated, like in argv, and start with their dash
+	 * count. Otherwise --verbose hashes like "--verbose" given after --. */
+	uint64_t h = fnv1a_64_basis;
+	bool succeeded = canonicalize<args_size>(argc, argv, args,
+			[&](std::string_view dashes, std::string_view text) {
+				const char kind = char('0' + dashes.size());
+				h = fnv1a_64(std::string_view(&kind, 1), h);
+				h = fnv1a_64(dashes, h);
+				h = fnv1a_64(text, h);
+				h = fnv1a_64(std::string_view("", 1), h);
+			},
+			option);
+
+	if (succeeded)
+		hash = h;
+	return succeeded;
+}
+
 inline flag operator|(flag lhs, flag rhs) {
 	return static_cast<flag>(
 			static_cast<unsigned int>(lhs) | static_cast<unsigned int>(rhs));
@@ -769,16 +2052,12 @@ inline basic_stack_string<N>& basic_stack_string<N>::operator+=(
 template <size_t N>
 inline basic_stack_string<N>& basic_stack_string<N>::operator+=(
 		std::string_view rhs) {
-	if (rhs[rhs.size() - 1] != 0) {
-		char safe_rhs[N] = {};
-		size_t len = std::min(N - 1, rhs.size());
-		for (size_t i = 0; i < len; ++i) {
-			safe_rhs[i] = rhs[i];
-		}
-		return this->operator+=(safe_rhs);
-	}
-
-	return this->operator+=(rhs.data());
+	/* Truncates. Never reads past rhs or writes past our buffer. */
+	size_t len = std::min(_max_size - _head, rhs.size());
+	memcpy(_data + _head, rhs.data(), len);
+	_head += len;
+	assert(_data[N - 1] == 0);
+	return *this;
 }
 
 template <size_t N>
@@ -791,94 +2070,43 @@ inline basic_stack_string<N>& basic_stack_string<N>::operator+=(char rhs) {
 template <size_t N>
 inline basic_stack_string<N>& basic_stack_string<N>::operator+=(
 		const char* rhs) {
-	memcpy(_data + _head, rhs, _max_size - _head);
-	assert(_data[N - 1] == 0);
-
-	_head = (_head + strlen(rhs)) % _max_size;
-	assert(_head <= N - 1);
-	return *this;
+	return this->operator+=(std::string_view(rhs));
 }
 
-
-inline void print_description(std::string_view s, size_t indentation) {
-	if (s.size() == 0)
+template <class Func>
+void trie::for_each_prefixed(std::string_view s, Func&& func) const {
+	int n = find_node(s);
+	if (n == not_found)
 		return;
 
-	// There is no \n.
-	if (s.find('\n') == std::string_view::npos) {
-		printf("%.*s\n", (int)s.size(), s.data());
+	if (nodes[n].arg_index != not_found && !func(nodes[n].arg_index))
 		return;
-	}
-
-	size_t pos = 0;
-	for (size_t found_pos;
-			(found_pos = s.find('\n', pos)) != std::string_view::npos;) {
-		std::string_view out = s.substr(pos, found_pos - pos);
-		printf("%.*s\n", (int)out.size(), out.data());
-		pos = found_pos + 1;
-
-		// Look ahead.
-		if (s.find('\n', pos) != std::string_view::npos) {
-			printf("%*s", (int)indentation, "");
-		}
-	}
-
-	// Still text left to print.
-	if (pos < s.size()) {
-		printf("%*s", (int)indentation, "");
-		std::string_view out = s.substr(pos, s.size() - pos);
-		printf("%.*s\n", (int)out.size(), out.data());
-	}
-}
-
-inline bool do_exit(const argument* args, size_t args_size,
-		const options& option, const char* arg0) {
-	if (!has_flag(option.flags, flag::dont_print_help)) {
-		print_help(args, args_size, arg0, option);
-	}
-
-	if (has_flag(option.flags, flag::exit_on_error))
-		exit(option.exit_code);
-	return false;
+	for_each_below(n, func);
 }
 
-inline bool char_compare_no_case(unsigned char lhs, unsigned char rhs) {
-	return std::tolower(lhs) == std::tolower(rhs);
-}
-
-inline bool compare_no_case(const char* lhs, std::string_view rhs,
-		const size_t lhs_start_pos, const size_t rhs_start_pos) {
-	if (lhs_start_pos >= strlen(lhs))
-		return false;
-
-	if (rhs_start_pos >= rhs.size())
-		return false;
-
-	if (strlen(lhs) - lhs_start_pos == rhs.size() - rhs_start_pos) {
-		return std::equal(lhs + lhs_start_pos, lhs + strlen(lhs),
-				rhs.begin() + rhs_start_pos, char_compare_no_case);
+template <class Func>
+bool trie::for_each_below(int n, Func& func) const {
+	for (int child = nodes[n].first_child; child != -1;
+			child = nodes[child].next_sibling) {
+		if (nodes[child].arg_index != not_found
+				&& !func(nodes[child].arg_index))
+			return false;
+		if (!for_each_below(child, func))
+			return false;
 	}
-	return false;
-}
-
-inline bool compare_no_case(std::string_view lhs, std::string_view rhs,
-		const size_t lhs_start_pos, const size_t rhs_start_pos) {
-	return compare_no_case(lhs.data(), rhs, lhs_start_pos, rhs_start_pos);
-}
-
-inline void maybe_print_msg(const options& option, stack_string msg) {
-	maybe_print_msg(option, msg.c_str());
-}
-
-inline void maybe_print_msg(const options& option, std::string_view msg) {
-	if (has_flag(option.flags, flag::no_user_error_messages))
-		return;
-	printf("%.*s\n", (int)msg.size(), msg.data());
+	return true;
 }
 
 inline bool has_flag(const flag flags, flag flag_to_check) {
 	return (flags & (flag_to_check)) != 0;
 }
 
+#if defined(NS_GETOPT_COMPILED)
+extern template struct basic_stack_string<stack_string_size>;
+#endif
 } // namespace detail
 } // namespace opt
+
+#if !defined(NS_GETOPT_COMPILED)
+#include <ns_getopt/ns_getopt-inl.h>
+#endif
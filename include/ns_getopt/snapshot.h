@@ -0,0 +1,482 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2017, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include <ns_getopt/ns_getopt.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <vector>
+
+namespace opt {
+/**
+ * Flat copy of a parse_result, for processes which can't share argv : pre
+ * fork workers reading it from shared memory or a memfd, for example. No
+ * pointers, only offsets from the start, so it is read in place wherever
+ * it is mapped, at any alignment. Values are copied in, defaults included.
+ *
+ * Layout, native endian 32 bit words :
+ *   header  : magic, version, total size, args_size.
+ *   entries : per argument, argv_index, count, value offset, value size,
+ *             first value, values count.
+ *   values  : per value, offset and size.
+ *   strings : NUL terminated.
+ **/
+
+/* Bytes write_snapshot needs. */
+inline size_t snapshot_size(const parse_result& result);
+
+/* Writes result to out. False if out_size is too small. */
+inline bool write_snapshot(
+		const parse_result& result, void* out, size_t out_size);
+
+/* Values of an argument, read in place. */
+struct snapshot_values {
+	const unsigned char* base = nullptr;
+	size_t first = 0; // Offset of the first value entry.
+	size_t size = 0;
+
+	inline std::string_view operator[](size_t i) const;
+	bool empty() const {
+		return size == 0;
+	}
+};
+
+/* Reads a snapshot in place, O(1) per query. */
+struct snapshot_view {
+	inline snapshot_view(const void* data, size_t data_size);
+
+	/* Checks the header and that every offset lies in the snapshot. Call
+	 * once on untrusted memory, queries don't check. */
+	inline bool valid() const;
+
+	inline size_t size() const; // Number of arguments.
+	inline bool has(size_t id) const;
+	inline std::string_view get(size_t id) const; // Last value if repeated.
+	inline snapshot_values values(size_t id) const;
+	inline int position(size_t id) const; // Index in argv, -1 if absent.
+	inline size_t count(size_t id) const;
+
+private:
+	inline uint32_t field(size_t id, size_t f) const;
+
+	const unsigned char* _data;
+	size_t _data_size;
+};
+
+/**
+ * Publishes snapshots to reader threads, read-copy-update style. publish
+ * copies a parse_result into a new cache line aligned block and swaps it
+ * in with one atomic store. Readers never lock, retry or wait : a read
+ * announces the current epoch in the reader's own cache line, then loads
+ * the snapshot. A replaced snapshot is freed by a later publish or
+ * reclaim, once no reader announced an epoch in which it was current.
+ *
+ * Each reader thread joins once and keeps its slot. Reads don't nest, and
+ * a long read only delays freeing, never publishing. Publishers are
+ * serialized between themselves.
+ **/
+struct snapshot_publisher {
+	/* A reader's epoch, alone on its cache line. 0 when not reading. */
+	struct alignas(64) slot {
+		std::atomic<uint64_t> epoch{ 0 };
+		std::atomic<bool> used{ false };
+	};
+
+	/* Reads one snapshot, alive until the guard is destroyed. */
+	struct read_guard {
+		inline ~read_guard();
+		read_guard(const read_guard&) = delete;
+		read_guard& operator=(const read_guard&) = delete;
+
+		/* False if nothing was published yet. */
+		explicit operator bool() const {
+			return _published;
+		}
+		const snapshot_view& operator*() const {
+			return _view;
+		}
+		const snapshot_view* operator->() const {
+			return &_view;
+		}
+
+	private:
+		friend struct snapshot_publisher;
+		inline read_guard(slot* s, const void* data, size_t data_size);
+
+		slot* _slot;
+		snapshot_view _view;
+		bool _published;
+	};
+
+	inline explicit snapshot_publisher(size_t max_readers = 64,
+			std::pmr::memory_resource* resource
+			= std::pmr::get_default_resource());
+	/* No reader may be reading. */
+	inline ~snapshot_publisher();
+
+	snapshot_publisher(const snapshot_publisher&) = delete;
+	snapshot_publisher& operator=(const snapshot_publisher&) = delete;
+
+	/* Claims a reader slot, nullptr once max_readers are taken. */
+	inline slot* join();
+
+	/* Gives the slot back. Its reader mustn't be reading. */
+	inline void leave(slot* s);
+
+	/* Wait-free : two loads and a store to enter, a store to leave. */
+	inline read_guard read(slot* s) const;
+
+	/* Copies result into a new snapshot and publishes it, then reclaims.
+	 * False if result doesn't fit a snapshot. */
+	inline bool publish(const parse_result& result);
+
+	/* Frees replaced snapshots no reader can still see. Returns the number
+	 * left for later. */
+	inline size_t reclaim();
+
+private:
+	/* Snapshot header, the snapshot starts on the next cache line. */
+	struct alignas(64) block {
+		size_t size;
+		uint64_t retired; // Last epoch in which it was current.
+		block* next;
+	};
+
+	inline void free_block(block* b);
+
+	std::pmr::memory_resource* _resource;
+	std::pmr::vector<slot> _slots;
+
+	/* Read by every reader, written by publish only. */
+	alignas(64) std::atomic<uint64_t> _epoch{ 1 };
+	std::atomic<block*> _current{ nullptr };
+
+	alignas(64) std::mutex _mutex;
+	block* _retired = nullptr;
+};
+
+namespace detail {
+constexpr uint32_t snapshot_magic = 0x4f47534e; // "NSGO"
+constexpr uint32_t snapshot_version = 1;
+constexpr size_t snapshot_header_size = 4 * sizeof(uint32_t);
+constexpr size_t snapshot_entry_size = 6 * sizeof(uint32_t);
+constexpr size_t snapshot_value_size = 2 * sizeof(uint32_t);
+
+/* Unaligned, and without aliasing the bytes. */
+inline uint32_t load_u32(const unsigned char* p) {
+	uint32_t ret;
+	memcpy(&ret, p, sizeof(ret));
+	return ret;
+}
+
+inline void store_u32(unsigned char* p, uint32_t v) {
+	memcpy(p, &v, sizeof(v));
+}
+} // namespace detail
+
+
+/**
+ * Implementation.
+ **/
+
+inline size_t snapshot_size(const parse_result& result) {
+	using namespace detail;
+
+	size_t ret = snapshot_header_size + result.size * snapshot_entry_size;
+	for (size_t i = 0; i < result.size; ++i) {
+		ret += result.get(i).size() + 1;
+		for (std::string_view v : result.values(i)) {
+			ret += snapshot_value_size + v.size() + 1;
+		}
+	}
+	return ret;
+}
+
+inline bool write_snapshot(
+		const parse_result& result, void* out, size_t out_size) {
+	using namespace detail;
+
+	const size_t size = snapshot_size(result);
+	if (out_size < size || size > UINT32_MAX)
+		return false;
+
+	unsigned char* base = static_cast<unsigned char*>(out);
+	store_u32(base, snapshot_magic);
+	store_u32(base + 4, snapshot_version);
+	store_u32(base + 8, (uint32_t)size);
+	store_u32(base + 12, (uint32_t)result.size);
+
+	size_t values_count = 0;
+	for (size_t i = 0; i < result.size; ++i) {
+		values_count += result.values(i).size;
+	}
+
+	const size_t entries = snapshot_header_size;
+	const size_t values = entries + result.size * snapshot_entry_size;
+	size_t next_value = values;
+	size_t next_string = values + values_count * snapshot_value_size;
+
+	auto write_string = [&](std::string_view s) {
+		const size_t offset = next_string;
+		if (!s.empty())
+			memcpy(base + offset, s.data(), s.size());
+		base[offset + s.size()] = '\0';
+		next_string += s.size() + 1;
+		return (uint32_t)offset;
+	};
+
+	for (size_t i = 0; i < result.size; ++i) {
+		unsigned char* e = base + entries + i * snapshot_entry_size;
+		const std::string_view value = result.get(i);
+		const argv_span vals = result.values(i);
+
+		store_u32(e, (uint32_t)result.position(i));
+		store_u32(e + 4, (uint32_t)result.count(i));
+		store_u32(e + 8, write_string(value));
+		store_u32(e + 12, (uint32_t)value.size());
+		store_u32(e + 16, (uint32_t)next_value);
+		store_u32(e + 20, (uint32_t)vals.size);
+
+		for (std::string_view v : vals) {
+			store_u32(base + next_value, write_string(v));
+			store_u32(base + next_value + 4, (uint32_t)v.size());
+			next_value += snapshot_value_size;
+		}
+	}
+	assert(next_string == size);
+	return true;
+}
+
+inline std::string_view snapshot_values::operator[](size_t i) const {
+	assert(i < size);
+	const unsigned char* v = base + first + i * detail::snapshot_value_size;
+	return { (const char*)base + detail::load_u32(v),
+		detail::load_u32(v + 4) };
+}
+
+inline snapshot_view::snapshot_view(const void* data, size_t data_size)
+		: _data(static_cast<const unsigned char*>(data))
+		, _data_size(data_size) {
+}
+
+inline bool snapshot_view::valid() const {
+	using namespace detail;
+
+	if (_data_size < snapshot_header_size
+			|| load_u32(_data) != snapshot_magic
+			|| load_u32(_data + 4) != snapshot_version
+			|| load_u32(_data + 8) > _data_size
+			|| load_u32(_data + 8) < snapshot_header_size)
+		return false;
+
+	/* Entries must fit after the header, before any offset is computed. */
+	const size_t size = load_u32(_data + 8);
+	const size_t args_size = load_u32(_data + 12);
+	if (args_size > (size - snapshot_header_size) / snapshot_entry_size)
+		return false;
+
+	/* A string and its NUL must fit. */
+	auto string_fits = [&](size_t offset, size_t length) {
+		return offset < size && length < size - offset
+				&& _data[offset + length] == '\0';
+	};
+
+	for (size_t i = 0; i < args_size; ++i) {
+		if (!string_fits(field(i, 2), field(i, 3)))
+			return false;
+
+		const size_t first = field(i, 4);
+		const size_t count = field(i, 5);
+		if (first > size || count > (size - first) / snapshot_value_size)
+			return false;
+		for (size_t j = 0; j < count; ++j) {
+			const unsigned char* v = _data + first + j * snapshot_value_size;
+			if (!string_fits(load_u32(v), load_u32(v + 4)))
+				return false;
+		}
+	}
+	return true;
+}
+
+inline size_t snapshot_view::size() const {
+	return detail::load_u32(_data + 12);
+}
+
+inline bool snapshot_view::has(size_t id) const {
+	return position(id) != -1;
+}
+
+inline std::string_view snapshot_view::get(size_t id) const {
+	return { (const char*)_data + field(id, 2), field(id, 3) };
+}
+
+inline snapshot_values snapshot_view::values(size_t id) const {
+	return { _data, field(id, 4), field(id, 5) };
+}
+
+inline int snapshot_view::position(size_t id) const {
+	return (int32_t)field(id, 0);
+}
+
+inline size_t snapshot_view::count(size_t id) const {
+	return field(id, 1);
+}
+
+inline uint32_t snapshot_view::field(size_t id, size_t f) const {
+	assert(id < size());
+	return detail::load_u32(_data + detail::snapshot_header_size
+			+ id * detail::snapshot_entry_size + f * sizeof(uint32_t));
+}
+
+inline snapshot_publisher::read_guard::read_guard(
+		slot* s, const void* data, size_t data_size)
+		: _slot(s)
+		, _view(data, data_size)
+		, _published(data != nullptr) {
+}
+
+inline snapshot_publisher::read_guard::~read_guard() {
+	/* Release, the snapshot reads happen before it may be freed. */
+	_slot->epoch.store(0, std::memory_order_release);
+}
+
+inline snapshot_publisher::snapshot_publisher(
+		size_t max_readers, std::pmr::memory_resource* resource)
+		: _resource(resource)
+		, _slots(max_readers, resource) {
+}
+
+inline snapshot_publisher::~snapshot_publisher() {
+	if (block* b = _current.load(std::memory_order_relaxed))
+		free_block(b);
+
+	while (_retired != nullptr) {
+		block* next = _retired->next;
+		free_block(_retired);
+		_retired = next;
+	}
+}
+
+inline snapshot_publisher::slot* snapshot_publisher::join() {
+	for (slot& s : _slots) {
+		bool expected = false;
+		if (s.used.compare_exchange_strong(
+					expected, true, std::memory_order_acq_rel))
+			return &s;
+	}
+	return nullptr;
+}
+
+inline void snapshot_publisher::leave(slot* s) {
+	assert(s->epoch.load(std::memory_order_relaxed) == 0);
+	s->used.store(false, std::memory_order_release);
+}
+
+inline snapshot_publisher::read_guard snapshot_publisher::read(
+		slot* s) const {
+	assert(s->used.load(std::memory_order_relaxed));
+	assert(s->epoch.load(std::memory_order_relaxed) == 0 && "nested read");
+
+	/* A stale epoch only holds back more snapshots. The announce must be
+	 * visible before _current is loaded, hence seq_cst on both sides,
+	 * publish does the mirror image. */
+	s->epoch.store(_epoch.load(std::memory_order_acquire),
+			std::memory_order_seq_cst);
+	const block* b = _current.load(std::memory_order_seq_cst);
+	if (b == nullptr)
+		return read_guard(s, nullptr, 0);
+	return read_guard(s, b + 1, b->size);
+}
+
+inline bool snapshot_publisher::publish(const parse_result& result) {
+	static_assert(sizeof(block) == 64, "snapshot must be cache line aligned");
+
+	const size_t size = snapshot_size(result);
+	if (size > UINT32_MAX)
+		return false;
+
+	/* Written in full before publishing, never touched after. */
+	block* b = static_cast<block*>(
+			_resource->allocate(sizeof(block) + size, alignof(block)));
+	new (b) block{ size, 0, nullptr };
+	write_snapshot(result, b + 1, size);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		block* old = _current.exchange(b, std::memory_order_seq_cst);
+		if (old != nullptr) {
+			/* Readers which load the next epoch load b, or newer. */
+			old->retired = _epoch.fetch_add(1, std::memory_order_seq_cst);
+			old->next = _retired;
+			_retired = old;
+		}
+	}
+	reclaim();
+	return true;
+}
+
+inline size_t snapshot_publisher::reclaim() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	uint64_t oldest = UINT64_MAX;
+	for (const slot& s : _slots) {
+		const uint64_t e = s.epoch.load(std::memory_order_seq_cst);
+		if (e != 0 && e < oldest)
+			oldest = e;
+	}
+
+	size_t ret = 0;
+	block** link = &_retired;
+	while (*link != nullptr) {
+		block* b = *link;
+		if (b->retired < oldest) {
+			*link = b->next;
+			free_block(b);
+		} else {
+			link = &b->next;
+			++ret;
+		}
+	}
+	return ret;
+}
+
+inline void snapshot_publisher::free_block(block* b) {
+	_resource->deallocate(b, sizeof(block) + b->size, alignof(block));
+}
+} // namespace opt
@@ -0,0 +1,340 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2017, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+#pragma once
+#include <ns_getopt/ns_getopt.h>
+
+/* Hot reload requires inotify. */
+#if defined(__linux__) && __has_include(<sys/inotify.h>)
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace opt {
+/**
+ * Applies a config file of command line arguments, then re-applies it
+ * whenever it changes on disk. A reload parses the whole file, but only
+ * invokes the callbacks of options whose values differ from the last
+ * successful load. Unchanged options are not touched.
+ *
+ * The file holds arguments separated by whitespace, as typed on a command
+ * line. A token starting with '#' comments out the rest of the line.
+ * Options removed from the file are reset where that means something :
+ * count_arg gets 0, list_arg and variadic_arg an empty span, default_arg
+ * its default. Other removed options aren't called.
+ *
+ * The parent directory is watched, so editors replacing the file by
+ * renaming over it are caught. args must outlive the watcher, option is
+ * copied.
+ **/
+template <size_t args_size>
+struct config_watcher {
+	config_watcher(const char* path, std::array<argument, args_size>& args,
+			const options& option = {});
+	config_watcher(const char* path, argument (&args)[args_size],
+			const options& option = {});
+	config_watcher(
+			const char* path, argument* args, const options& option = {});
+	~config_watcher();
+
+	config_watcher(const config_watcher&) = delete;
+	config_watcher& operator=(const config_watcher&) = delete;
+
+	/* Parses the file and dispatches what changed since the last
+	 * successful load, everything the first time. Returns the number of
+	 * callbacks invoked, -1 if the file couldn't be read or parsed, or if
+	 * a callback failed. The previous values are kept on failure. */
+	int reload();
+
+	/* Waits up to timeout_ms for the file to change (0 polls, -1 blocks),
+	 * then reloads. Returns 0 if nothing changed, like reload otherwise. */
+	int update(int timeout_ms = 0);
+
+	/* inotify descriptor, readable when update has something to do. Poll
+	 * it from an existing event loop. -1 if watching failed. */
+	int fd() const;
+
+	/* Last successfully applied values, points into the file text. */
+	const parse_result& current() const;
+
+private:
+	/* A parsed file. parse_result points into text, never moved. */
+	struct generation {
+		std::string text;
+		std::vector<char const*> argv;
+		std::array<parsed_arg, args_size> parsed;
+		parse_result result{ parsed.data(), args_size };
+	};
+
+	std::string _path;
+	std::string _file_name;
+	argument* _args;
+	const options _option;
+	compiled_table<args_size> _table;
+	std::array<generation, 2> _generations;
+	size_t _current = 0;
+	std::array<detail::parse_event, args_size> _events;
+	int _fd = -1;
+};
+
+namespace detail {
+/* Reads path and splits it in place into argv, argv[0] being path. */
+inline bool read_config(const char* path, std::string& text,
+		std::vector<char const*>& argv);
+
+/* Whether two parses of an argument hold the same values. */
+inline bool same_values(const parsed_arg& lhs, const parsed_arg& rhs);
+
+/* Event resetting an argument removed from the config, false if there is
+ * no sensible reset for its type. */
+inline bool removed_event(const argument& arg, int arg_index, parse_event& ev);
+
+/* True if the inotify events in fd mention file_name. Drains fd. */
+inline bool file_changed(int fd, std::string_view file_name);
+} // namespace detail
+
+
+/**
+ * Implementation.
+ **/
+
+template <size_t args_size>
+config_watcher<args_size>::config_watcher(const char* path,
+		std::array<argument, args_size>& args, const options& option)
+		: config_watcher(path, args.data(), option) {
+}
+
+template <size_t args_size>
+config_watcher<args_size>::config_watcher(
+		const char* path, argument (&args)[args_size], const options& option)
+		: config_watcher(path, (argument*)args, option) {
+}
+
+template <size_t args_size>
+config_watcher<args_size>::config_watcher(
+		const char* path, argument* args, const options& option)
+		: _path(path)
+		, _args(args)
+		, _option(option)
+		, _table(args) {
+	std::string dir = ".";
+	size_t slash = _path.find_last_of('/');
+	_file_name = _path.substr(slash == std::string::npos ? 0 : slash + 1);
+	if (slash != std::string::npos)
+		dir = slash == 0 ? "/" : _path.substr(0, slash);
+
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_fd == -1)
+		return;
+
+	if (inotify_add_watch(_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO)
+			== -1) {
+		close(_fd);
+		_fd = -1;
+	}
+}
+
+template <size_t args_size>
+config_watcher<args_size>::~config_watcher() {
+	if (_fd != -1)
+		close(_fd);
+}
+
+template <size_t args_size>
+int config_watcher<args_size>::reload() {
+	const generation& prev = _generations[_current];
+	generation& next = _generations[_current ^ 1];
+
+	if (!detail::read_config(_path.c_str(), next.text, next.argv))
+		return -1;
+
+	if (!detail::parse_into((int)next.argv.size(), next.argv.data(), _args,
+				args_size, _table.table(), next.result, _option))
+		return -1;
+
+	/* Only what changed, in argv order like parse_arguments. Removed
+	 * options come first, they have no position. */
+	size_t events_size = 0;
+	for (size_t i = 0; i < args_size; ++i) {
+		const parsed_arg& p = prev.parsed[i];
+		const parsed_arg& n = next.parsed[i];
+		if (detail::same_values(p, n))
+			continue;
+
+		detail::parse_event& ev = _events[events_size];
+		if (n.argv_index == -1) {
+			if (!detail::removed_event(_args[i], (int)i, ev))
+				continue;
+		} else {
+			ev = { (int)i, n.argv_index, n.values_index, n.values_count,
+				n.value, n.values, n.count };
+		}
+		++events_size;
+	}
+	std::stable_sort(_events.begin(), _events.begin() + events_size,
+			[](const detail::parse_event& lhs, const detail::parse_event& rhs) {
+				return lhs.argv_index < rhs.argv_index;
+			});
+
+	if (!detail::dispatch_events(_args, args_size, _events.data(),
+				events_size, next.argv.data(), _option))
+		return -1;
+
+	_current ^= 1;
+	return (int)events_size;
+}
+
+template <size_t args_size>
+int config_watcher<args_size>::update(int timeout_ms) {
+	if (_fd == -1)
+		return 0;
+
+	pollfd p{ _fd, POLLIN, 0 };
+	if (::poll(&p, 1, timeout_ms) <= 0)
+		return 0;
+
+	if (!detail::file_changed(_fd, _file_name))
+		return 0;
+	return reload();
+}
+
+template <size_t args_size>
+int config_watcher<args_size>::fd() const {
+	return _fd;
+}
+
+template <size_t args_size>
+const parse_result& config_watcher<args_size>::current() const {
+	return _generations[_current].result;
+}
+
+namespace detail {
+inline bool read_config(const char* path, std::string& text,
+		std::vector<char const*>& argv) {
+	FILE* f = fopen(path, "rb");
+	if (f == nullptr)
+		return false;
+
+	text.clear();
+	char buf[4096];
+	for (size_t read; (read = fread(buf, 1, sizeof(buf), f)) > 0;) {
+		text.append(buf, read);
+	}
+	bool failed = ferror(f) != 0;
+	fclose(f);
+	if (failed)
+		return false;
+
+	/* Tokens are terminated in place, text isn't resized past here. */
+	argv.clear();
+	argv.push_back(path);
+	for (size_t i = 0; i < text.size();) {
+		if (isspace((unsigned char)text[i])) {
+			text[i++] = '\0';
+			continue;
+		}
+		if (text[i] == '#') {
+			while (i < text.size() && text[i] != '\n') {
+				text[i++] = '\0';
+			}
+			continue;
+		}
+
+		argv.push_back(text.data() + i);
+		while (i < text.size() && !isspace((unsigned char)text[i])) {
+			++i;
+		}
+	}
+	return true;
+}
+
+inline bool same_values(const parsed_arg& lhs, const parsed_arg& rhs) {
+	if ((lhs.argv_index == -1) != (rhs.argv_index == -1)
+			|| lhs.count != rhs.count || lhs.value != rhs.value
+			|| lhs.values_count != rhs.values_count)
+		return false;
+
+	if (lhs.values == nullptr || rhs.values == nullptr)
+		return lhs.values == rhs.values;
+
+	for (int i = 0; i < lhs.values_count; ++i) {
+		if (strcmp(lhs.values[i], rhs.values[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+inline bool removed_event(const argument& arg, int arg_index, parse_event& ev) {
+	ev = { arg_index, -1, -1, 0, {}, nullptr, 0 };
+	switch (arg.arg_type) {
+	case type::count_arg:
+	case type::list_arg:
+	case type::variadic_arg: {
+		return true;
+	}
+	case type::default_arg: {
+		ev.value = arg.default_arg;
+		return true;
+	}
+	default: {
+		return false;
+	}
+	}
+}
+
+inline bool file_changed(int fd, std::string_view file_name) {
+	bool ret = false;
+	alignas(inotify_event) char buf[4096];
+	for (ssize_t len; (len = read(fd, buf, sizeof(buf))) > 0;) {
+		for (char* p = buf; p < buf + len;) {
+			const inotify_event* ev = (const inotify_event*)p;
+			if (ev->len > 0 && file_name == ev->name)
+				ret = true;
+			p += sizeof(inotify_event) + ev->len;
+		}
+	}
+	return ret;
+}
+} // namespace detail
+} // namespace opt
+#endif
@@ -0,0 +1,742 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2017, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <ns_getopt/ns_getopt.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * ns_getopt_gen, compiles an option schema to a header. Usually invoked
+ * through the ns_getopt_generate CMake function.
+ *
+ * Schema, one statement per line, '#' starts a comment :
+ *   namespace <name>        Namespace of the generated code, required.
+ *   intro "<text>"          Help intro.
+ *   outro "<text>"          Help outro.
+ *   optional                Arguments are optional (arguments_are_optional).
+ *   option <long> <type> [short=<c>] [default=<v>] [as=<t>] ["<text>"]
+ *
+ * <type> is an opt::type name. as=string|int|uint|double picks the C++
+ * type of a single value option's accessor, string by default. Strings
+ * accept \n, \" and \\ escapes.
+ *
+ * The header holds the argument table and the lookup index as constexpr
+ * data, print_help's output and a parser with an accessor per option.
+ * Parsing builds nothing. The parser makes its opt::argument array once,
+ * on construction, without callbacks : the parse marks arguments parsed,
+ * and opt::argument holds std::function members, so it can't be constant.
+ **/
+
+namespace {
+enum class value_type { string, int_, uint_, double_ };
+
+struct schema_option {
+	std::string long_arg;
+	opt::type arg_type = opt::type::no_arg;
+	char short_arg = '\0';
+	std::string default_arg;
+	std::string description;
+	value_type as = value_type::string;
+	std::string name; // C++ identifier.
+};
+
+struct schema {
+	std::string name_space;
+	std::string intro;
+	std::string outro;
+	bool optional = false;
+	std::vector<schema_option> options;
+};
+
+const char* const type_names[] = { "no_arg", "required_arg", "optional_arg",
+	"default_arg", "multi_arg", "raw_arg", "variadic_arg", "count_arg",
+	"list_arg" };
+
+const char* const value_type_names[] = { "string", "int", "uint", "double" };
+
+/* Can't be accessor names. */
+const char* const reserved_names[] = { "alignas", "alignof", "and", "asm",
+	"auto", "bool", "break", "case", "catch", "char", "class", "const",
+	"constexpr", "continue", "default", "delete", "do", "double", "else",
+	"enum", "explicit", "export", "extern", "false", "float", "for",
+	"friend", "goto", "if", "inline", "int", "long", "mutable", "namespace",
+	"new", "noexcept", "not", "nullptr", "operator", "or", "private",
+	"protected", "public", "register", "return", "short", "signed",
+	"sizeof", "static", "struct", "switch", "template", "this", "throw",
+	"true", "try", "typedef", "typename", "union", "unsigned", "using",
+	"virtual", "void", "volatile", "while", "xor", "has", "parse",
+	"result" };
+
+bool error(const std::string& file, int line, const std::string& msg) {
+	fprintf(stderr, "%s:%d: error: %s\n", file.c_str(), line, msg.c_str());
+	return false;
+}
+
+bool takes_single_value(opt::type t) {
+	return t == opt::type::required_arg || t == opt::type::optional_arg
+			|| t == opt::type::default_arg || t == opt::type::raw_arg;
+}
+
+std::string identifier(const std::string& s) {
+	std::string ret;
+	for (char c : s) {
+		ret += std::isalnum((unsigned char)c) ? c : '_';
+	}
+	if (ret.empty() || std::isdigit((unsigned char)ret[0]))
+		ret.insert(ret.begin(), '_');
+	for (const char* r : reserved_names) {
+		if (ret == r)
+			return ret + "_";
+	}
+	return ret;
+}
+
+/* Splits a line in words, quoted strings being one word. */
+bool tokenize(const std::string& line, std::vector<std::string>& out) {
+	out.clear();
+	for (size_t i = 0; i < line.size();) {
+		if (std::isspace((unsigned char)line[i])) {
+			++i;
+			continue;
+		}
+		if (line[i] == '#')
+			break;
+
+		std::string word;
+		bool quoted = false;
+		while (i < line.size()
+				&& (quoted || !std::isspace((unsigned char)line[i]))) {
+			char c = line[i++];
+			if (c == '"') {
+				quoted = !quoted;
+			} else if (c == '\\' && quoted && i < line.size()) {
+				c = line[i++];
+				word += c == 'n' ? '\n' : c;
+			} else {
+				word += c;
+			}
+		}
+		if (quoted)
+			return false;
+		out.push_back(word);
+	}
+	return true;
+}
+
+bool parse_option(const std::string& file, int line,
+		const std::vector<std::string>& words, schema_option& o) {
+	if (words.size() < 3)
+		return error(file, line, "expected 'option <long> <type>'.");
+
+	o.long_arg = words[1];
+	o.name = identifier(o.long_arg);
+
+	bool found = false;
+	for (size_t i = 0; i < std::size(type_names); ++i) {
+		if (words[2] == type_names[i]) {
+			o.arg_type = opt::type(i);
+			found = true;
+		}
+	}
+	if (!found)
+		return error(file, line, "unknown type '" + words[2] + "'.");
+
+	const bool positional = o.arg_type == opt::type::raw_arg
+			|| o.arg_type == opt::type::variadic_arg;
+	bool has_description = false;
+	for (size_t i = 3; i < words.size(); ++i) {
+		const std::string& w = words[i];
+		const size_t eq = w.find('=');
+		const std::string key = w.substr(0, eq);
+		const std::string value
+				= eq == std::string::npos ? "" : w.substr(eq + 1);
+
+		if (eq != std::string::npos && key == "short") {
+			if (value.size() != 1 || positional)
+				return error(file, line, "bad short argument '" + w + "'.");
+			o.short_arg = value[0];
+		} else if (eq != std::string::npos && key == "default") {
+			if (o.arg_type != opt::type::default_arg)
+				return error(file, line, "only default_arg has a default.");
+			o.default_arg = value;
+		} else if (eq != std::string::npos && key == "as") {
+			if (!takes_single_value(o.arg_type))
+				return error(file, line, "as= needs a single value type.");
+			found = false;
+			for (size_t j = 0; j < std::size(value_type_names); ++j) {
+				if (value == value_type_names[j]) {
+					o.as = value_type(j);
+					found = true;
+				}
+			}
+			if (!found)
+				return error(file, line, "unknown value type '" + value + "'.");
+		} else if (!has_description) {
+			o.description = w;
+			has_description = true;
+		} else {
+			return error(file, line, "unexpected '" + w + "'.");
+		}
+	}
+
+	/* The default is converted like a parsed value, check it now. */
+	if (o.as != value_type::string && !o.default_arg.empty()) {
+		const char* v = o.default_arg.c_str();
+		char* end = nullptr;
+		if (o.as == value_type::double_) {
+			std::strtod(v, &end);
+		} else {
+			std::strtoll(v, &end, 10);
+		}
+		if (*end != '\0')
+			return error(file, line, "default isn't a number.");
+	}
+	return true;
+}
+
+bool read_schema(const std::string& file, schema& out) {
+	FILE* f = fopen(file.c_str(), "rb");
+	if (f == nullptr) {
+		fprintf(stderr, "Couldn't open '%s'.\n", file.c_str());
+		return false;
+	}
+	std::string text;
+	char buf[4096];
+	for (size_t read; (read = fread(buf, 1, sizeof(buf), f)) > 0;) {
+		text.append(buf, read);
+	}
+	fclose(f);
+
+	std::vector<std::string> words;
+	int line = 0;
+	for (size_t beg = 0; beg < text.size();) {
+		size_t end = text.find('\n', beg);
+		if (end == std::string::npos)
+			end = text.size();
+		++line;
+
+		if (!tokenize(text.substr(beg, end - beg), words))
+			return error(file, line, "unterminated string.");
+		beg = end + 1;
+		if (words.empty())
+			continue;
+
+		const std::string& kw = words[0];
+		if (kw == "option") {
+			schema_option o;
+			if (!parse_option(file, line, words, o))
+				return false;
+			for (const schema_option& x : out.options) {
+				if (opt::detail::compare_no_case(x.long_arg, o.long_arg))
+					return error(file, line, "'" + o.long_arg + "' redefined.");
+				if (x.name == o.name)
+					return error(file, line, "'" + o.long_arg
+									+ "' clashes with '" + x.long_arg + "'.");
+			}
+			out.options.push_back(o);
+		} else if (kw == "namespace" && words.size() == 2) {
+			out.name_space = words[1];
+		} else if (kw == "intro" && words.size() == 2) {
+			out.intro = words[1];
+		} else if (kw == "outro" && words.size() == 2) {
+			out.outro = words[1];
+		} else if (kw == "optional" && words.size() == 1) {
+			out.optional = true;
+		} else {
+			return error(file, line, "unknown statement '" + kw + "'.");
+		}
+	}
+
+	if (out.name_space.empty())
+		return error(file, line, "missing namespace.");
+	if (out.options.empty())
+		return error(file, line, "no options.");
+	if (out.options.size() > INT16_MAX)
+		return error(file, line, "too many options.");
+	return true;
+}
+
+std::string quote(const std::string& s) {
+	std::string ret = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c == '\n') {
+			ret += "\\n";
+		} else if (c == '\t') {
+			ret += "\\t";
+		} else {
+			ret += c;
+		}
+	}
+	return ret + "\"";
+}
+
+std::string char_literal(char c) {
+	if (c == '\0')
+		return "'\\0'";
+	if (c == '\'' || c == '\\')
+		return std::string("'\\") + c + "'";
+	return std::string("'") + c + "'";
+}
+
+/* print_help's output, split around the program name. */
+bool capture_help(const std::vector<opt::argument>& args,
+		const opt::options& option, std::string& head, std::string& tail) {
+	const char* const marker = "\x1f";
+
+	FILE* tmp = tmpfile();
+	if (tmp == nullptr)
+		return false;
+	fflush(stdout);
+	const int saved = dup(fileno(stdout));
+	dup2(fileno(tmp), fileno(stdout));
+	opt::print_help(args.data(), args.size(), marker, option);
+	fflush(stdout);
+	dup2(saved, fileno(stdout));
+
+	std::string text;
+	rewind(tmp);
+	char buf[4096];
+	for (size_t read; (read = fread(buf, 1, sizeof(buf), tmp)) > 0;) {
+		text.append(buf, read);
+	}
+	fclose(tmp);
+
+	const size_t pos = text.find(marker);
+	if (pos == std::string::npos)
+		return false;
+	head = text.substr(0, pos);
+	tail = text.substr(pos + 1);
+	return true;
+}
+
+/* Smallest power of 2 table where no long name collides, or the regular
+ * size if there is none up to 64 slots per argument. */
+size_t perfect_slots_size(const std::vector<opt::argument>& args) {
+	const size_t min_size = opt::detail::lookup_slots_size(args.size());
+	for (size_t size = min_size; size <= min_size * 32; size <<= 1) {
+		std::vector<bool> used(size, false);
+		bool collides = false;
+		for (const opt::argument& a : args) {
+			if (a.arg_type == opt::type::raw_arg
+					|| a.arg_type == opt::type::variadic_arg)
+				continue;
+			size_t s = opt::detail::hash_no_case(a.long_arg) & (size - 1);
+			if (used[s]) {
+				collides = true;
+				break;
+			}
+			used[s] = true;
+		}
+		if (!collides)
+			return size;
+	}
+	return min_size;
+}
+
+const char* accessor_type(const schema_option& o) {
+	if (o.arg_type == opt::type::no_arg)
+		return "bool";
+	if (o.arg_type == opt::type::count_arg)
+		return "size_t";
+	if (!takes_single_value(o.arg_type))
+		return "opt::argv_span";
+
+	switch (o.as) {
+	case value_type::int_:
+		return "long long";
+	case value_type::uint_:
+		return "unsigned long long";
+	case value_type::double_:
+		return "double";
+	default:
+		return "std::string_view";
+	}
+}
+
+/* Expression converting the NUL terminated string v to a number. */
+std::string conversion(
+		value_type as, const std::string& v, const std::string& end) {
+	switch (as) {
+	case value_type::int_:
+		return "std::strtoll(" + v + ", " + end + ", 10)";
+	case value_type::uint_:
+		return "std::strtoull(" + v + ", " + end + ", 10)";
+	default:
+		return "std::strtod(" + v + ", " + end + ")";
+	}
+}
+
+std::string generate(const schema& sc, const std::string& schema_file) {
+	const size_t size = sc.options.size();
+
+	/* Same table the parser would build, dumped as data. */
+	std::vector<opt::argument> args;
+	args.reserve(size);
+	for (const schema_option& o : sc.options) {
+		args.push_back({ o.long_arg, o.arg_type, o.description, o.short_arg,
+				o.default_arg });
+	}
+
+	const size_t slots_size = perfect_slots_size(args);
+	std::vector<opt::lookup_slot> slots(slots_size);
+	std::vector<int16_t> short_args(256);
+	std::vector<opt::type> types(size);
+	std::vector<int16_t> positionals(size);
+	opt::detail::lookup_table table{ slots.data(), slots_size - 1,
+		short_args.data(), types.data(), positionals.data(), 0, -1 };
+	table.build(args.data(), size);
+
+	bool perfect = true;
+	for (size_t i = 0; i < slots_size; ++i) {
+		if (slots[i].arg_index != -1
+				&& (slots[i].hash & (slots_size - 1)) != i)
+			perfect = false;
+	}
+
+	std::string help_head;
+	std::string help_tail;
+	const opt::options option(sc.intro, sc.outro,
+			sc.optional ? opt::arguments_are_optional : opt::none);
+	if (!capture_help(args, option, help_head, help_tail)) {
+		fprintf(stderr, "Couldn't capture the help text.\n");
+		exit(-1);
+	}
+
+	std::string o;
+	auto line = [&](const std::string& s) { o += s + "\n"; };
+	const std::string n = std::to_string(size);
+
+	line("/* Generated by ns_getopt_gen from " + schema_file
+			+ ", do not edit. */");
+	line("#pragma once");
+	line("#include <ns_getopt/ns_getopt.h>");
+	line("");
+	line("#include <array>");
+	line("#include <cerrno>");
+	line("#include <cstdio>");
+	line("#include <cstdlib>");
+	line("#include <string_view>");
+	line("");
+	line("namespace " + sc.name_space + " {");
+	line("constexpr size_t args_size = " + n + ";");
+	line("");
+	line("/* Argument indices, in declared order. */");
+	line("enum class id : size_t {");
+	for (const schema_option& x : sc.options) {
+		line("\t" + x.name + ",");
+	}
+	line("};");
+	line("");
+	line("struct option_info {");
+	line("\tstd::string_view long_arg;");
+	line("\topt::type arg_type;");
+	line("\tchar short_arg;");
+	line("\tstd::string_view default_arg;");
+	line("\tstd::string_view description;");
+	line("};");
+	line("");
+	line("constexpr std::array<option_info, args_size> table = { {");
+	for (const schema_option& x : sc.options) {
+		line("\t\t{ " + quote(x.long_arg) + ", opt::type::"
+				+ type_names[(size_t)x.arg_type] + ", "
+				+ char_literal(x.short_arg) + ", " + quote(x.default_arg)
+				+ ", " + quote(x.description) + " },");
+	}
+	line("} };");
+	line("");
+	line("/* print_help output, the program name goes in between. */");
+	line("constexpr std::string_view help_head = " + quote(help_head) + ";");
+	line("constexpr std::string_view help_tail = " + quote(help_tail) + ";");
+	line("");
+	line("inline void print_help(const char* arg0) {");
+	line("\tprintf(\"%.*s%s%.*s\", (int)help_head.size(), help_head.data(), "
+		 "arg0,");
+	line("\t\t\t(int)help_tail.size(), help_tail.data());");
+	line("}");
+	line("");
+
+	line("namespace detail {");
+	line(perfect ? "/* Lookup index, never written. Perfect hash, every long "
+				   "argument sits"
+				 : "/* Lookup index, never written. No perfect hash found, "
+				   "some long");
+	line(perfect ? " * in its first slot. */" : " * arguments are probed. */");
+	line("inline constexpr opt::lookup_slot slots["
+			+ std::to_string(slots_size) + "] = {");
+	std::string row;
+	for (size_t i = 0; i < slots_size; ++i) {
+		row += "{ " + std::to_string(slots[i].hash) + "u, "
+				+ std::to_string(slots[i].arg_index) + ", "
+				+ std::to_string(slots[i].alias) + " },";
+		if (i % 4 == 3 || i + 1 == slots_size) {
+			line("\t" + row);
+			row.clear();
+		} else {
+			row += " ";
+		}
+	}
+	line("};");
+
+	auto int16_array = [&](const char* name, const int16_t* data,
+							   size_t data_size) {
+		line(std::string("inline constexpr int16_t ") + name + "["
+				+ std::to_string(std::max(data_size, size_t(1))) + "] = {");
+		std::string row;
+		for (size_t i = 0; i < data_size; ++i) {
+			row += std::to_string(data[i]) + ",";
+			if (i % 16 == 15 || i + 1 == data_size) {
+				line("\t" + row);
+				row.clear();
+			} else {
+				row += " ";
+			}
+		}
+		line("};");
+	};
+	int16_array("short_args", short_args.data(), 256);
+	int16_array("positionals", positionals.data(), table.positionals_size);
+
+	line("inline constexpr opt::type types[args_size] = {");
+	for (opt::type t : types) {
+		line(std::string("\topt::type::") + type_names[(size_t)t] + ",");
+	}
+	line("};");
+	line("inline constexpr opt::prebuilt_table lookup{ slots, "
+			+ std::to_string(slots_size - 1) + ", short_args, types,");
+	line("\tpositionals, " + std::to_string(table.positionals_size) + ", "
+			+ std::to_string(table.variadic_arg) + " };");
+	line("} // namespace detail");
+	line("");
+
+	line("/**");
+	line(" * Parses against the tables above, without callbacks. Accessors "
+		 "return");
+	line(" * the parsed value, or the schema default when absent. Values "
+		 "point into");
+	line(" * argv, keep it around.");
+	line(" **/");
+	line("struct parser {");
+	line("\tparser();");
+	line("\t/* _result points into _parsed. */");
+	line("\tparser(const parser&) = delete;");
+	line("\tparser& operator=(const parser&) = delete;");
+	line("");
+	line("\t/* Like parse_results, the help printed is the static one. "
+		 "Fails if a");
+	line("\t * number doesn't convert. */");
+	line("\tbool parse(int argc, char const* const* argv,");
+	line("\t\t\topt::flag flags = opt::flag::none, int exit_code = -1);");
+	line("");
+	line("\tbool has(id i) const;");
+	for (const schema_option& x : sc.options) {
+		line(std::string("\t") + accessor_type(x) + " " + x.name
+				+ "() const;");
+	}
+	line("");
+	line("\tconst opt::parse_result& result() const;");
+	line("");
+	line("private:");
+	line("\tbool convert(opt::flag flags) const;");
+	line("");
+	line("\tstd::array<opt::argument, args_size> _args;");
+	line("\tstd::array<opt::parsed_arg, args_size> _parsed;");
+	line("\topt::parse_result _result;");
+	line("};");
+	line("");
+
+	line("inline parser::parser()");
+	line("\t\t: _args{ {");
+	for (size_t i = 0; i < size; ++i) {
+		const std::string t = "table[" + std::to_string(i) + "]";
+		line("\t\t\t\t{ " + t + ".long_arg, " + t + ".arg_type, " + t
+				+ ".description,");
+		line("\t\t\t\t\t\t" + t + ".short_arg, " + t + ".default_arg },");
+	}
+	line("\t\t} }");
+	line("\t\t, _result(_parsed.data(), args_size) {");
+	line("}");
+	line("");
+
+	line("inline bool parser::parse(int argc, char const* const* argv,");
+	line("\t\topt::flag flags, int exit_code) {");
+	line("\t/* Errors are reported here, with the static help. */");
+	line("\tconst opt::flag schema_flags = opt::flag("
+			+ std::string(sc.optional ? "opt::arguments_are_optional"
+									  : "opt::none")
+			+ ");");
+	line("\tconst opt::options option(\"\", \"\",");
+	line("\t\t\topt::flag((flags | schema_flags | opt::dont_print_help)");
+	line("\t\t\t\t\t& ~opt::exit_on_error));");
+	line("\tif (opt::parse_results<args_size>(argc, argv, _args.data(),");
+	line("\t\t\t\tdetail::lookup, _result, option)");
+	line("\t\t\t&& convert(flags))");
+	line("\t\treturn true;");
+	line("");
+	line("\tif (!(flags & opt::dont_print_help))");
+	line("\t\tprint_help(argc > 0 ? argv[0] : \"\");");
+	line("\tif (flags & opt::exit_on_error)");
+	line("\t\texit(exit_code);");
+	line("\treturn false;");
+	line("}");
+	line("");
+
+	line("inline bool parser::convert(opt::flag flags) const {");
+	bool has_numbers = false;
+	for (size_t i = 0; i < size; ++i) {
+		const schema_option& x = sc.options[i];
+		if (x.as == value_type::string)
+			continue;
+
+		has_numbers = true;
+		const std::string idx = std::to_string(i);
+		line("\tif (!_result.get(" + idx + ").empty()) {");
+		line("\t\tconst char* v = _result.get(" + idx + ").data();");
+		line("\t\tchar* end = nullptr;");
+		line("\t\terrno = 0;");
+		line("\t\t" + conversion(x.as, "v", "&end") + ";");
+		line(std::string("\t\tif (*end != '\\0' || end == v || errno == ERANGE")
+				+ (x.as == value_type::uint_ ? "\n\t\t\t\t|| *v == '-'" : "")
+				+ ") {");
+		line("\t\t\tif (!(flags & opt::no_user_error_messages))");
+		line("\t\t\t\tprintf(\"'%s' isn't a valid value for '--"
+				+ x.long_arg + "'.\\n\", v);");
+		line("\t\t\treturn false;");
+		line("\t\t}");
+		line("\t}");
+	}
+	if (!has_numbers)
+		line("\t(void)flags;");
+	line("\treturn true;");
+	line("}");
+	line("");
+
+	line("inline bool parser::has(id i) const {");
+	line("\treturn _result.has((size_t)i);");
+	line("}");
+	for (size_t i = 0; i < size; ++i) {
+		const schema_option& x = sc.options[i];
+		const std::string idx = std::to_string(i);
+		line("");
+		line(std::string("inline ") + accessor_type(x) + " parser::" + x.name
+				+ "() const {");
+		if (x.arg_type == opt::type::no_arg) {
+			line("\treturn _result.has(" + idx + ");");
+		} else if (x.arg_type == opt::type::count_arg) {
+			line("\treturn _result.count(" + idx + ");");
+		} else if (!takes_single_value(x.arg_type)) {
+			line("\treturn _result.values(" + idx + ");");
+		} else {
+			line("\tconst std::string_view v = _result.get(" + idx + ");");
+			if (x.as == value_type::string) {
+				line("\treturn v.empty() ? " + quote(x.default_arg) + " : v;");
+			} else {
+				/* Literals are NUL terminated, like argv. */
+				line("\treturn "
+						+ conversion(x.as,
+								"v.empty() ? " + quote(x.default_arg)
+										+ " : v.data()",
+								"nullptr")
+						+ ";");
+			}
+		}
+		line("}");
+	}
+	line("");
+	line("inline const opt::parse_result& parser::result() const {");
+	line("\treturn _result;");
+	line("}");
+	line("} // namespace " + sc.name_space);
+	return o;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+	std::string schema_file;
+	std::string out_file;
+	std::array<opt::argument, 2> args = { {
+			{ "schema", opt::type::raw_arg,
+					[&](std::string_view s) {
+						schema_file = s;
+						return true;
+					},
+					"Option schema." },
+			{ "output", opt::type::raw_arg,
+					[&](std::string_view s) {
+						out_file = s;
+						return true;
+					},
+					"Generated header." },
+	} };
+	const opt::options option("ns_getopt_gen, compiles an option schema to "
+							  "a header.");
+	if (!opt::parse_arguments(argc, argv, args, option))
+		return -1;
+
+	schema sc;
+	if (!read_schema(schema_file, sc))
+		return -1;
+
+	const std::string name
+			= schema_file.substr(schema_file.find_last_of("/\\") + 1);
+	const std::string text = generate(sc, name);
+
+	FILE* f = fopen(out_file.c_str(), "wb");
+	if (f == nullptr
+			|| fwrite(text.data(), 1, text.size(), f) != text.size()) {
+		fprintf(stderr, "Couldn't write '%s'.\n", out_file.c_str());
+		if (f != nullptr)
+			fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}